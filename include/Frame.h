@@ -39,6 +39,9 @@ namespace ORB_SLAM2
 {
 #define FRAME_GRID_ROWS 48
 #define FRAME_GRID_COLS 64
+//optical flow(KLT) window & pyramid levels used by the KLT Frames
+#define KLT_WIN_SIZE 21
+#define KLT_MAX_LEVEL 3
 
 class MapPoint;
 class KeyFrame;
@@ -63,6 +66,9 @@ public:
   const NavState& GetNavState(void){//cannot use const &(make mutex useless)
     return mNavState;//don't call copy constructor, just for template of PoseOptimization() & PreIntegration
   }
+  const NavState& GetNavStateTrack(void){//Frames aren't changed by other threads, just for template of PoseOptimization()
+    return mNavState;
+  }
   void UpdatePoseFromNS();//replace SetPose(), directly update mNavState for efficiency and then please call this func. to update Tcw
   void UpdateNavStatePVRFromTcw();//for imu data empty condition after imu's initialized(including bias recomputed)
   
@@ -91,20 +97,28 @@ public:
 public:
     Frame();
 
-    // Copy constructor. use default = func. is the mGrid[A][B] copy OK?
+    // Copy constructor.
     Frame(const Frame &frame);
+    //move operations only steal the buffers(no Mat.clone()), Tracking uses them to hand mCurrentFrame over to mLastFrame
+    Frame(Frame &&frame) = default;
+    Frame& operator=(Frame &&frame) = default;
+    Frame& operator=(const Frame &frame) = default;//shallow as before(Mats share data), declared for the move ones suppress it
 
-    // Constructor for stereo cameras.
-    Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth);
+    // Constructor for stereo cameras. mask(CV_8UC1, 0 means excluded) is the dynamic mask of the left image.
+    Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, const cv::Mat &mask=cv::Mat());
 
-    // Constructor for RGB-D cameras.
-    Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth);
+    // Constructor for RGB-D cameras. imDepth is the raw CV_16U(or CV_32F) depth, only scaled by depthFactor at the keypoints.
+    Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const float &depthFactor, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, const cv::Mat &mask=cv::Mat());
 
     // Constructor for Monocular cameras.
-    Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth);
+    Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, const cv::Mat &mask=cv::Mat());
+
+    // Constructor for RGB-D(imDepth is like above)/Monocular(imDepth is empty) frames between KFs: the inlier MapPoints' keypoints of lastFrame
+    // are tracked by optical flow from vPyrLast to vPyr(cv::buildOpticalFlowPyramid()) and keep their descriptors, no ORB extraction
+    Frame(const std::vector<cv::Mat> &vPyrLast, const std::vector<cv::Mat> &vPyr, const cv::Mat &imDepth, const float &depthFactor, const double &timeStamp, const Frame &lastFrame, const cv::Mat &mask=cv::Mat());
 
-    // Extract ORB on the image. 0 for left image and 1 for right image.
-    void ExtractORB(int flag, const cv::Mat &im);
+    // Extract ORB on the image. 0 for left image and 1 for right image. The static masks are applied by the extractors.
+    void ExtractORB(int flag, const cv::Mat &im, const cv::Mat &mask=cv::Mat());
 
     // Compute Bag of Words representation.
     void ComputeBoW();//compute mBowVec && mFeatVec
@@ -128,6 +142,9 @@ public:
     // Check if a MapPoint is in the frustum of the camera
     // and fill variables of the MapPoint to be used by the tracking
     bool isInFrustum(MapPoint* pMP, float viewingCosLimit);
+    // Batched version for the local map: the MapPoints are copied into SoA buffers(one lock each) and tested in one SIMD pass,
+    // the visible ones get the same tracking variables as above and are returned in vpInView
+    int isInFrustum(const std::vector<MapPoint*> &vpMPs, float viewingCosLimit, std::vector<MapPoint*> &vpInView);
 
     // Compute the cell of a keypoint (return false if outside the grid)
     bool PosInGrid(const cv::KeyPoint &kp, int &posX, int &posY);
@@ -139,7 +156,7 @@ public:
     void ComputeStereoMatches();
 
     // Associate a "right" coordinate to a keypoint if there is valid depth in the depthmap.
-    void ComputeStereoFromRGBD(const cv::Mat &imDepth);
+    void ComputeStereoFromRGBD(const cv::Mat &imDepth, const float depthFactor=1.0f);//depth=imDepth(CV_16U/CV_32F)*depthFactor
 
     // Backprojects a keypoint (if stereo/depth info available) into 3D world coordinates.
     cv::Mat UnprojectStereo(const int &i);
@@ -201,10 +218,16 @@ public:
     // Flag to identify outlier associations.
     std::vector<bool> mvbOutlier;
 
+    // Features tracked by optical flow from the last frame instead of extracted(mvpMapPoints keep their MapPoints), such a Frame can't be a KeyFrame
+    bool mbKLT;
+
     // Keypoints are assigned to cells in a grid to reduce matching complexity when projecting MapPoints.
     static float mfGridElementWidthInv;
     static float mfGridElementHeightInv;
-    std::vector<std::size_t> mGrid[FRAME_GRID_COLS][FRAME_GRID_ROWS];
+    // CSR layout: the keypoints of cell (i,j) are mvGridIndices[mvGridStart[c],mvGridStart[c+1]) in ascending order, c=i*FRAME_GRID_ROWS+j,
+    // so the cells of one column are contiguous
+    std::vector<int> mvGridIndices;
+    std::vector<int> mvGridStart;//FRAME_GRID_COLS*FRAME_GRID_ROWS+1 offsets, empty if no keypoint was assigned
 
     // Camera pose.
     cv::Mat mTcw;
@@ -233,6 +256,15 @@ public:
 
     static bool mbInitialComputations;
 
+    // Undistorted coordinates of every integer pixel position in [0,cols]x[0,rows] of the left image (CV_32FC2, computed once per calibration).
+    static cv::Mat mUndistortLUT;
+    static bool mbUndistortLUTValid;//false until built for the current mK/mDistCoef, cleared by Tracking::ChangeCalibration()
+
+    // Undistortion lookup table of the calibration K,distCoef, rebuilt when !mbUndistortLUTValid or the image size changes.
+    // Only this function depends on the distortion model, the keypoints are undistorted by bilinear interpolation.
+    // Tracking builds it from Camera.width/height, the Frames only build it when the image size doesn't match.
+    static void ComputeUndistortLUT(const cv::Mat &K, const cv::Mat &distCoef, const int cols, const int rows);
+
 
 private:
 
@@ -247,6 +279,10 @@ private:
     // Assign keypoints to the grid for speed up feature matching (called in the constructor).
     void AssignFeaturesToGrid();
 
+    // Matches the left keypoints [iBegin,iEnd) of ComputeStereoMatches(), vRowStart/vRowIndices is the row table of the right keypoints.
+    void ComputeStereoMatchesBand(const std::vector<int> &vRowStart, const std::vector<int> &vRowIndices, const int iBegin, const int iEnd,
+                                  std::vector<std::pair<int,int> > &vDistIdx);
+
     // Rotation, translation and camera center
     cv::Mat mRcw;
     cv::Mat mtcw;
@@ -73,6 +73,10 @@ public:
     unique_lock<mutex> lock(mMutexNavState);
     return mNavState;//call copy constructor
   }
+  //for the Tracking thread only: mNavState is copied with the local MapPoints(MapPoint::SnapshotForTrack()) under mMutexMapUpdate,
+  //GetNavStateTrack() returns the copy if it belongs to the current snapshot, else GetNavState()
+  void SnapshotForTrack();
+  NavState GetNavStateTrack();
   void SetNavState(const NavState& ns){
     unique_lock<mutex> lock(mMutexNavState);
     mNavState=ns;
@@ -288,6 +292,8 @@ public:
 
     // Variables used by the tracking
     long unsigned int mnTrackReferenceForFrame;//for local Map in tracking
+    long unsigned int mnTrackSnapshotId;//MapPoint::nTrackSnapshotId of mNavStateTrack
+    NavState mNavStateTrack;
     long unsigned int mnFuseTargetForKF;//for LocalMapping
 
     // Variables used by the local mapping
@@ -359,8 +365,9 @@ protected:
     KeyFrameDatabase* mpKeyFrameDB;
     ORBVocabulary* mpORBvocabulary;
 
-    // Grid over the image to speed up feature matching
-    std::vector< std::vector <std::vector<size_t> > > mGrid;
+    // Grid over the image to speed up feature matching, the CSR layout of Frame::mvGridIndices/mvGridStart
+    std::vector<int> mvGridIndices;
+    std::vector<int> mvGridStart;
 
     std::map<KeyFrame*,int> mConnectedKeyFrameWeights;//covisibility graph need KFs (>0 maybe unidirectional edge!maybe u can revise it~) covisible MapPoints 
     std::vector<KeyFrame*> mvpOrderedConnectedKeyFrames;//ordered covisibility graph/connected KFs need KFs >=15 covisible MPs or the KF with Max covisible MapPoints
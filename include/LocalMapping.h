@@ -27,6 +27,7 @@
 #include "Map.h"
 #include "LoopClosing.h"
 #include "Tracking.h"
+#include "WorkerPool.h"
 //#include "KeyFrameDatabase.h"//unused
 
 #include <mutex>
@@ -92,6 +93,14 @@ protected:
     void CreateNewMapPoints();//match CurrentKF with neighbors by BoW && validated by epipolar constraint,\
     triangulate the far/too close points by Linear Triangulation Method/depth data, then check it through positive depth, projection error(chi2 distri.) && scale consistency,\
     finally update pMP infomation(like mObservations,normal,descriptor,insert in mpMap,KFs,mlpRecentAddedMapPoints)
+    struct TriangulatedMatch{//a candidate new MapPoint from the matched pair (idx1 in mpCurrentKeyFrame, idx2 in pKF2)
+      size_t idx1,idx2;
+      cv::Mat x3D;
+    };
+    //match && triangulate mpCurrentKeyFrame with pKF2 without touching the map, so different neighbors can run concurrently
+    void TriangulateNeighbor(KeyFrame* pKF2,std::vector<TriangulatedMatch> &vTriangulated);
+    //create the MapPoints of vTriangulated serially, skipping the keypoints already given a MapPoint by a former neighbor
+    void AddTriangulatedMapPoints(KeyFrame* pKF2,const std::vector<TriangulatedMatch> &vTriangulated);
 
     void MapPointCulling();//delete some bad && too long ago MapPoints in mlpRecentAddedMapPoints
     void SearchInNeighbors();//find 2 layers(10,5) of neighbor KFs in covisibility graph, bijection search matches in neighbors and mpCurrentKeyFrame then fuse them,\
@@ -141,6 +150,8 @@ protected:
 
     bool mbAcceptKeyFrames;
     std::mutex mMutexAccept;
+
+    WorkerPool* mpWorkerPool;//for CreateNewMapPoints(), NULL when LocalMapping.nThreads<=1
 };
 
 } //namespace ORB_SLAM
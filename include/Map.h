@@ -42,6 +42,8 @@ class Map
     bool operator()(const KeyFrame* kfleft,const KeyFrame* kfright) const;
   };
   int mnChangeIdx;// Index related to any change when mMutexMapUpdate is locked && current KF's Pose is changed
+  double mdScaleChange;//product of the scales applied to the whole map(IMU Initialization)
+  int mnPoseJumpIdx;//Index related to KFs' Poses jumped under mMutexMapUpdate(loop correction/PoseGraph/GBA), unlike mnBigChangeIdx it's increased before the lock is released
   
 public:
   //for scale updation in IMU Initialization thread
@@ -55,6 +57,23 @@ public:
     unique_lock<mutex> lock(mMutexMap);
     return mnChangeIdx;
   }
+  void InformNewScale(const double &scale){//the whole map is rescaled, it's also a change for Tracking's bMapUpdated
+    unique_lock<std::mutex> lock(mMutexMap);
+    mdScaleChange*=scale;
+    ++mnChangeIdx;
+  }
+  double GetScaleChange(){//used by Tracking to rescale the Frame tracked during a scale update
+    unique_lock<mutex> lock(mMutexMap);
+    return mdScaleChange;
+  }
+  void InformPoseJump(){//mMutexMapUpdate locked
+    unique_lock<std::mutex> lock(mMutexMap);
+    ++mnPoseJumpIdx;
+  }
+  int GetLastPoseJumpIdx(){//used by Tracking to reanchor the Frame tracked during a loop correction/GBA
+    unique_lock<mutex> lock(mMutexMap);
+    return mnPoseJumpIdx;
+  }
   void ClearBadMPs();
   void clearMPs();
   
@@ -85,7 +104,8 @@ public:
     vector<KeyFrame*> mvpKeyFrameOrigins;//pushed pKFini in StereoInitialization() in Tracking for RGBD
 
     std::mutex mMutexMapUpdate;//update KFs' Pose and their mvpMapPoints' Pos and KF&&MP's relation(KF.mvpMapPoints&&MP.mObservations), \
-    used in LocalBA in LocalMapping && CorrectLoop()(&& SearchAndFuse()&&PoseGraphOpt.) in LoopClosing && GBA thread
+    used in LocalBA in LocalMapping && CorrectLoop()(&& SearchAndFuse()&&PoseGraphOpt.) in LoopClosing && GBA thread, \
+    Tracking only takes it to commit the initial map/new KFs
 
     // This avoid that two points are created simultaneously in separate threads (id conflict)
     std::mutex mMutexPointCreation;//used in new MapPoint() in Tracking/LocalMapping thread
@@ -86,6 +86,12 @@ public:
 
     void UpdateNormalAndDepth();
 
+    void GetFrustumData(float* pos, float* normal, float &minDistance, float &maxDistance);//mWorldPos,mNormalVector,mfMin/MaxDistance under one lock, for Frame::isInFrustum(vector)
+    //for the Tracking thread only: Tracking::SnapshotLocalMap() copies the data of the local MPs under mMutexMapUpdate,
+    //the XXXTrack() getters return the copy if it belongs to the current snapshot(nTrackSnapshotId), else the current data
+    void SnapshotForTrack();
+    cv::Mat GetWorldPosTrack();
+    void GetFrustumDataTrack(float* pos, float* normal, float &minDistance, float &maxDistance);
     float GetMinDistanceInvariance();//0.8*mfMinDistance
     float GetMaxDistanceInvariance();//1.2*mfMaxDistance
     int PredictScale(const float &currentDist, KeyFrame*pKF);
@@ -107,6 +113,11 @@ public:
     float mTrackViewCos;
     long unsigned int mnTrackReferenceForFrame;
     long unsigned int mnLastFrameSeen;
+    float mTrackSnapPos[3];//snapshot of mWorldPos
+    float mTrackSnapNormal[3];//of mNormalVector
+    float mfTrackSnapMinDist,mfTrackSnapMaxDist;//of mfMin/MaxDistance
+    long unsigned int mnTrackSnapshotId;
+    static long unsigned int nTrackSnapshotId;//current snapshot of the Tracking, increased by every snapshot && every new Frame
 
     // Variables used by local mapping
     long unsigned int mnBALocalForKF;//local BA in LocalMapping
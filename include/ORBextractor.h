@@ -23,7 +23,9 @@
 
 #include <vector>
 #include <list>
+#include <atomic>
 #include <opencv/cv.h>
+#include "WorkerPool.h"
 
 
 namespace ORB_SLAM2
@@ -32,16 +34,36 @@ namespace ORB_SLAM2
 class ExtractorNode
 {
 public:
-    ExtractorNode():bNoMore(false){}
+    ExtractorNode():nBegin(0),nEnd(0),nPrev(-1),nNext(-1),bNoMore(false){}
 
-    void DivideNode(ExtractorNode &n1, ExtractorNode &n2, ExtractorNode &n3, ExtractorNode &n4);
+    //stable in place partition of vKeyIdx[nBegin,nEnd) into the 4 children's subranges(vScratch is the temporary buffer)
+    void DivideNode(ExtractorNode &n1, ExtractorNode &n2, ExtractorNode &n3, ExtractorNode &n4,
+                    const std::vector<cv::KeyPoint> &vKeys, std::vector<int> &vKeyIdx, std::vector<int> &vScratch);
+
+    int size() const {return nEnd-nBegin;}
 
-    std::vector<cv::KeyPoint> vKeys;
     cv::Point2i UL, UR, BL, BR;//up left, up right, bottom left, bottom right
-    std::list<ExtractorNode>::iterator lit;//record pair<int,ExtractorNode*>.second as ExtractorNode::Iterator, for lNodes.erase(Iter)
+    int nBegin, nEnd;//the node's keypoints are vKeys[vKeyIdx[nBegin..nEnd-1]]
+    int nPrev, nNext;//the node list linked by indices of ExtractorNodePool::vNodes(-1 means none)
     bool bNoMore;
 };
 
+//arena of the quadtree of one level, its buffers keep their capacity across frames
+class ExtractorNodePool
+{
+public:
+    ExtractorNodePool():nHead(-1),nSize(0){}
+
+    void PushFront(int idx);
+    void Erase(int idx);
+
+    std::vector<ExtractorNode> vNodes;//all nodes created for this distribution, erased ones are just unlinked
+    std::vector<int> vKeyIdx, vScratch;
+    std::vector<std::pair<int,int> > vSizeAndNode, vPrevSizeAndNode;//(number of keypoints,node index) of the nodes to be expanded
+    int nHead;//first node of the list
+    int nSize;//number of linked nodes
+};
+
 class ORBextractor
 {
 public:
@@ -49,13 +71,13 @@ public:
     enum {HARRIS_SCORE=0, FAST_SCORE=1 };
 
     ORBextractor(int nfeatures, float scaleFactor, int nlevels,
-                 int iniThFAST, int minThFAST);
+                 int iniThFAST, int minThFAST, int nthreads=1);//nthreads>1 extracts the levels in parallel
 
     ~ORBextractor(){}
 
-    // Compute the ORB features and descriptors on an image.
+    // Compute the ORB features and descriptors on an image(gray, or BGR/RGB/BGRA/RGBA converted straight into the level 0 buffer).
     // ORB are dispersed on the image using an octree.
-    // Mask is ignored in the current implementation.
+    // Mask(CV_8UC1, image size, 0 means excluded) is combined with the static mask; excluded pixels are skipped before FAST.
     void operator()( cv::InputArray image, cv::InputArray mask,
       std::vector<cv::KeyPoint>& keypoints,
       cv::OutputArray descriptors);//all keypoints position is in level==0
@@ -63,6 +85,14 @@ public:
     int inline GetLevels(){
         return nlevels;}
 
+    // Change the number of features & of the extracted levels(<=nlevels, the upper ones are skipped) for the next images,
+    // scale factors keep nlevels entries, so the octaves of the Frames/MapPoints don't change
+    void SetFeaturesNum(int nfeatures, int nActiveLevels);
+    int inline GetFeaturesNum(){
+        return nfeatures;}
+    int inline GetActiveLevels(){
+        return mnActiveLevels;}
+
     float inline GetScaleFactor(){
         return scaleFactor;}
 
@@ -82,23 +112,70 @@ public:
         return mvInvLevelSigma2;
     }
 
-    std::vector<cv::Mat> mvImagePyramid;
+    // The per-level tasks are submitted to this pool when it's set(nthreads>1), else short-lived threads are used.
+    void SetWorkerPool(WorkerPool* pWorkerPool){
+        mpWorkerPool=pWorkerPool;}
+    WorkerPool* GetWorkerPool(){
+        return mpWorkerPool;}
+
+    // Color order of the 3/4 channels images(Camera.RGB)
+    void SetRGB(const bool bRGB){
+        mbRGB = bRGB;}
+
+    // Static mask of this camera(e.g. the vehicle body or an overlay) applied to every image, empty to disable.
+    void SetStaticMask(const cv::Mat &mask);
+
+    // Preallocate the pyramid & blur buffers for this image size; ComputePyramid() calls it again if the size changes.
+    void AllocatePyramid(const cv::Size &imageSize);
+
+    std::vector<cv::Mat> mvImagePyramid;//ROIs of mvPyramidBuffer, overwritten by the next image
 
 protected:
 
     void ComputePyramid(cv::Mat image);
+    void ComputeFeaturesPerLevel();//distributes nfeatures over the mnActiveLevels levels
+    void ComputeMaskPyramid(const cv::Mat &mask, const bool bStatic);//mask can be empty
     void ComputeKeyPointsOctTree(std::vector<std::vector<cv::KeyPoint> >& allKeypoints);    
-    std::vector<cv::KeyPoint> DistributeOctTree(const std::vector<cv::KeyPoint>& vToDistributeKeys, const int &minX,
-                                           const int &maxX, const int &minY, const int &maxY, const int &nFeatures, const int &level);
+    void ComputeKeyPointsLevel(const int &level, std::vector<cv::KeyPoint>& keypoints);//detect+distribute+orientation of one level
+    void ExtractLevel(const int &level);//ComputeKeyPointsLevel+blur+descriptors of one level into mvKeysLevel/mvDescLevel[level]
+    void ExtractLevelsWorker();//extract levels until mnNextLevel>=nlevels
+    void DistributeOctTree(const std::vector<cv::KeyPoint>& vToDistributeKeys, const int &minX,
+                           const int &maxX, const int &minY, const int &maxY, const int &nFeatures, const int &level,
+                           std::vector<cv::KeyPoint>& vResultKeys);//uses mvNodePool[level]
 
     void ComputeKeyPointsOld(std::vector<std::vector<cv::KeyPoint> >& allKeypoints);//finally unused function!
     std::vector<cv::Point> pattern;
+    std::vector<cv::Point> mvRotatedPattern;//pattern rotated to every angle bin
+    std::vector<std::vector<int> > mvPatternOffsets;//mvRotatedPattern as byte offsets in the blurred image of each level
+    std::vector<int> mvPatternStep;//the image step mvPatternOffsets[level] was made for
 
     int nfeatures;
     double scaleFactor;
     int nlevels;
     int iniThFAST;
     int minThFAST;
+    int mnActiveLevels;//only levels [0,mnActiveLevels) are built & extracted
+    bool mbRGB;
+
+    //per level task outputs & the next level to be taken by a worker
+    int mnThreads;
+    std::vector<std::vector<cv::KeyPoint> > mvKeysLevel;
+    std::vector<cv::Mat> mvDescLevel;//only the first mvKeysLevel[level].size() rows are valid
+
+    //persistent buffers reused across frames
+    cv::Size mImageSize;
+    std::vector<cv::Mat> mvPyramidBuffer;//level images with EDGE_THRESHOLD reflected borders
+    std::vector<cv::Mat> mvBlurBuffer;//Gaussian blurred level images for the descriptors
+    std::vector<ExtractorNodePool> mvNodePool;//quadtree arena of each level
+    std::atomic<int> mnNextLevel;
+    WorkerPool* mpWorkerPool;
+
+    //masks
+    cv::Mat mStaticMask;
+    cv::Mat mMaskBuffer;//static & dynamic mask
+    std::vector<cv::Mat> mvMaskPyramid;//mask of each mvImagePyramid level(INTER_NEAREST), empty means no mask
+    std::vector<uchar> mvbLevelMasked;//the whole level is masked, so nothing is extracted there
+    bool mbMaskPyramidStatic;//mvMaskPyramid is made from mStaticMask only and can be reused
 
     std::vector<int> mnFeaturesPerLevel;
 
@@ -23,6 +23,7 @@
 #define ORBMATCHER_H
 
 #include<vector>
+#include<algorithm>
 #include<opencv2/core/core.hpp>
 #include<opencv2/features2d/features2d.hpp>
 
@@ -43,9 +44,28 @@ public:
     // Computes the Hamming distance between two ORB descriptors(1*256bit/32*8bit)
     static int DescriptorDistance(const cv::Mat &a, const cv::Mat &b);
 
+    // Computes the Hamming distances between a and n descriptors(32 bytes each) at once, dists[i] is the one of ppB[i]
+    // The kernel is chosen at runtime: AVX-512 VPOPCNTDQ, AVX2 or POPCNT, plain bit operations otherwise
+    static void DescriptorDistances(const cv::Mat &a, const uchar* const* ppB, const int n, int* dists);
+    // vDists[i] is the distance between a and B.row(vIdx[i])
+    template <class T>
+    static void DescriptorDistances(const cv::Mat &a, const cv::Mat &B, const std::vector<T> &vIdx, std::vector<int> &vDists){
+        const size_t n=vIdx.size();
+        vDists.resize(n);
+        const uchar* ppB[64];//gathered in chunks to avoid allocations in the SearchBy*() loops
+        for(size_t i=0; i<n; i+=64){
+            const int nChunk=std::min<size_t>(64,n-i);
+            for(int j=0; j<nChunk; j++)
+                ppB[j]=B.ptr<uchar>(vIdx[i+j]);
+            DescriptorDistances(a,ppB,nChunk,&vDists[i]);
+        }
+    }
+
     // Search matches between Frame keypoints and projected MapPoints. Returns number of additional matches
     // Used to track the local map (Tracking)
-    int SearchByProjection(Frame &F, const std::vector<MapPoint*> &vpMapPoints, const float th=3);//rectify the F.mvpMapPoints
+    // With pWorkerPool the MapPoints are matched in parallel bands and a keypoint claimed by several of them goes to the smallest distance,
+    // the others are rematched serially to the free keypoints; this order differs from the serial(first-come) one
+    int SearchByProjection(Frame &F, const std::vector<MapPoint*> &vpMapPoints, const float th=3, WorkerPool* pWorkerPool=NULL);//rectify the F.mvpMapPoints
 
     // Project MapPoints tracked in last frame into the current frame and search matches.
     // Used to track from previous frame (Tracking)
@@ -99,7 +119,10 @@ protected:
 
     bool CheckDistEpipolarLine(const cv::KeyPoint &kp1, const cv::KeyPoint &kp2, const cv::Mat &F12, const KeyFrame *pKF);//95% confidence level when return true
 
-    float RadiusByViewingCos(const float &viewCos);
+    float RadiusByViewingCos(const float &viewCos) const;
+
+    // Best keypoint of F for pMP(projected by F.isInFrustum()) after the ratio test, -1 if none, F is only read
+    int MatchByProjection(const Frame &F, MapPoint* pMP, const float th, std::vector<int> &vDists, int &bestDist) const;
 
     void ComputeThreeMaxima(std::vector<int>* histo, const int L, int &ind1, int &ind2, int &ind3);
 
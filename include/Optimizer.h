@@ -52,7 +52,7 @@ public:
   int static PoseOptimization(Frame *pFrame, KeyFrame* pLastKF, const cv::Mat& gw,const bool bComputeMarg=false,const bool bNoMPs=false);//2 frames' motion-only BA, automatically fix/unfix lastF/KF and optimize curF/curF&last, if bComputeMarg then save its Hessian
   template<class KeyFrame>
   static void PoseOptimizationAddEdge(KeyFrame* pFrame,vector<g2o::EdgeNavStatePVRPointXYZOnlyPose*> &vpEdgesMono,vector<size_t> &vnIndexEdgeMono,
-			       const Matrix3d &Rcb,const Vector3d &tcb,g2o::SparseOptimizer &optimizer,int LastKFPVRId){}//we specialize the Frame version
+			       const Matrix3d &Rcb,const Vector3d &tcb,g2o::SparseOptimizer &optimizer,int LastKFPVRId){}//we specialize the Frame version, edges of the last F/KF must use pMP->GetWorldPosTrack() like pFrame
   void static LocalBAPRVIDP(KeyFrame *pKF, int Nlocal, bool* pbStopFlag, Map* pMap, cv::Mat &gw);
   void static LocalBundleAdjustmentNavStatePRV(KeyFrame* pKF, int Nlocal, bool *pbStopFlag, Map *pMap, cv::Mat gw);//Nlocal>=1(if <1 it's 1)
   void static GlobalBundleAdjustmentNavStatePRV(Map* pMap, const cv::Mat &gw, int nIterations=5, bool *pbStopFlag=NULL,
@@ -129,11 +129,12 @@ int Optimizer::PoseOptimization(Frame *pFrame, KeyFrame* pLastKF, const cv::Mat&
   vNSFBias->setEstimate(nsj);
   vNSFBias->setId(FrameBiasId);vNSFBias->setFixed(false);optimizer.addVertex(vNSFBias);
   // Set KeyFrame vertex PVR/Bias
+  const NavState nsi=pLastKF->GetNavStateTrack();//read once, the same snapshot as the MapPoints' Xw
   g2o::VertexNavStatePVR * vNSKFPVR = new g2o::VertexNavStatePVR();
-  vNSKFPVR->setEstimate(pLastKF->GetNavState());
+  vNSKFPVR->setEstimate(nsi);
   vNSKFPVR->setId(LastKFPVRId);vNSKFPVR->setFixed(bFixedLast);optimizer.addVertex(vNSKFPVR);
   g2o::VertexNavStateBias * vNSKFBias = new g2o::VertexNavStateBias();
-  vNSKFBias->setEstimate(pLastKF->GetNavState());
+  vNSKFBias->setEstimate(nsi);
   vNSKFBias->setId(LastKFBiasId);vNSKFBias->setFixed(bFixedLast);optimizer.addVertex(vNSKFBias);
 
   // Set IMU_I/PVR(B) edge(ternary/multi edge) between LastKF-Frame
@@ -233,7 +234,7 @@ int Optimizer::PoseOptimization(Frame *pFrame, KeyFrame* pLastKF, const cv::Mat&
 	      e->setRobustKernel(rk);
 	      rk->setDelta(deltaMono);
 
-	      e->SetParams(pFrame->fx,pFrame->fy,pFrame->cx,pFrame->cy,Rcb,tcb,Converter::toVector3d(pMP->GetWorldPos()));
+	      e->SetParams(pFrame->fx,pFrame->fy,pFrame->cx,pFrame->cy,Rcb,tcb,Converter::toVector3d(pMP->GetWorldPosTrack()));
 
 	      optimizer.addEdge(e);
 
@@ -264,7 +265,7 @@ int Optimizer::PoseOptimization(Frame *pFrame, KeyFrame* pLastKF, const cv::Mat&
 	      e->setRobustKernel(rk);
 	      rk->setDelta(deltaStereo);
 
-	      e->SetParams(pFrame->fx,pFrame->fy,pFrame->cx,pFrame->cy,Rcb,tcb,Converter::toVector3d(pMP->GetWorldPos()),&pFrame->mbf);//edge/measurement formula parameter Xw
+	      e->SetParams(pFrame->fx,pFrame->fy,pFrame->cx,pFrame->cy,Rcb,tcb,Converter::toVector3d(pMP->GetWorldPosTrack()),&pFrame->mbf);//edge/measurement formula parameter Xw
 
 	      optimizer.addEdge(e);//_error is the edge output
 
@@ -292,7 +293,7 @@ int Optimizer::PoseOptimization(Frame *pFrame, KeyFrame* pLastKF, const cv::Mat&
       // Reset estimate for vertexj
       vNSFPVR->setEstimate(nsj);vNSFBias->setEstimate(nsj);
       if (!bFixedLast){
-	vNSKFPVR->setEstimate(pLastKF->GetNavState());vNSKFBias->setEstimate(pLastKF->GetNavState());
+	vNSKFPVR->setEstimate(nsi);vNSKFBias->setEstimate(nsi);
       }
       
       optimizer.initializeOptimization(0);//default edges' level is 0, so initially use all edges to optimize, after it=0, just use inlier edges(_activeEdges) to optimize
@@ -27,6 +27,7 @@
 
 #include<string>
 #include<thread>
+#include<future>
 #include<opencv2/core/core.hpp>
 
 #include "Tracking.h"
@@ -69,7 +70,8 @@ public:
   
   // Process the given (IMU/encoder)odometry data. \
   mode==0:Encoder data 2 vl,vr; 1:qIMU data 4 qxyzw; \
-  2:Both 6 vl,vr,qxyzw; 3:Pure-IMU data 6 ax~z,wx~z(opposite of the order of EuRoc)
+  2:Both 6 vl,vr,qxyzw; 3:Pure-IMU data 6 ax~z,wx~z(opposite of the order of EuRoc); \
+  each sensor(encoder/IMU) must be fed by one thread only and in time order(the odom queues are single-producer, checked by assert)
   cv::Mat TrackOdom(const double &timestamp, const double* odomdata, const char mode);
   void FinalGBA(int nIterations=15,bool bRobust=false);//please call this after Shutdown(), Full BA (column/at the end of execution) in V-B of the VIORBSLAM paper
   
@@ -103,19 +105,31 @@ public:
 
     // Proccess the given stereo frame. Images must be synchronized and rectified.
     // Input images: RGB (CV_8UC3) or grayscale (CV_8U). RGB is converted to grayscale.
+    // Optional mask (CV_8U, 0 means no features there) of the left image, e.g. from a dynamic object detector.
     // Returns the camera pose (empty if tracking fails).
-    cv::Mat TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp);
+    cv::Mat TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp, const cv::Mat &mask=cv::Mat());
 
     // Process the given rgbd frame. Depthmap must be registered to the RGB frame.
     // Input image: RGB (CV_8UC3) or grayscale (CV_8U). RGB is converted to grayscale.
     // Input depthmap: Float (CV_32F).
+    // Optional mask (CV_8U, 0 means no features there) of the image.
     // Returns the camera pose (empty if tracking fails).
-    cv::Mat TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp);
+    cv::Mat TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp, const cv::Mat &mask=cv::Mat());
 
     // Proccess the given monocular frame
     // Input images: RGB (CV_8UC3) or grayscale (CV_8U). RGB is converted to grayscale.
+    // Optional mask (CV_8U, 0 means no features there) of the image.
     // Returns the camera pose (empty if tracking fails).
-    cv::Mat TrackMonocular(const cv::Mat &im, const double &timestamp);
+    cv::Mat TrackMonocular(const cv::Mat &im, const double &timestamp, const cv::Mat &mask=cv::Mat());
+
+    // Pipelined versions of the 3 functions above(Tracking.PipelineDepth>0 in the settings file): they return once the features are
+    // extracted and the frame is queued for the tracking thread, so the next frame can be extracted meanwhile.
+    // The future gets the camera pose(empty if tracking fails or the frame is dropped by Tracking.PipelineDrop: 1).
+    // Call them from one thread and keep the input images unmodified until the future is ready.
+    // Without the pipeline they track synchronously and return a ready future.
+    std::future<cv::Mat> TrackStereoAsync(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp, const cv::Mat &mask=cv::Mat());
+    std::future<cv::Mat> TrackRGBDAsync(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp, const cv::Mat &mask=cv::Mat());
+    std::future<cv::Mat> TrackMonocularAsync(const cv::Mat &im, const double &timestamp, const cv::Mat &mask=cv::Mat());
 
     // This stops local mapping thread (map building) and performs only camera tracking.
     void ActivateLocalizationMode();
@@ -194,6 +208,12 @@ private:
     std::thread* mptLocalMapping;
     std::thread* mptLoopClosing;
     std::thread* mptViewer;
+    std::thread* mptTracking;//pipelined tracking stage, NULL when Tracking runs in the thread calling TrackXXX()
+    void RunTracking();
+
+    // Mode change && reset requested by the Viewer/user, applied before a frame is grabbed
+    void CheckModeAndReset();
+    void UpdateTrackingState();//mTrackingState,mTrackedMapPoints,mTrackedKeyPointsUn after a frame is tracked
 
     // Reset flag
     std::mutex mMutexReset;
@@ -23,6 +23,7 @@
 #define TRACKING_H
 
 #include "OdomData.h"
+#include "OdomRing.h"
 #include<chrono>//for delay control
 
 //created by zzh over.
@@ -44,6 +45,10 @@
 #include "System.h"
 
 #include <mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include <deque>
 
 namespace ORB_SLAM2
 {
@@ -63,10 +68,10 @@ class Tracking
   void TrackWithOnlyOdom(bool bMapUpdated);
   // Odom PreIntegration
   template<class EncData>
-  inline bool iterijFind(const listeig(EncData) &mlOdomEnc,const double &curTime,
+  inline bool iterijFind(const OdomStore<EncData> &mlOdomEnc,const double &curTime,
 			 typename listeig(EncData)::const_iterator &iter,const double&errOdomImg,bool bSearchBack=true);
   template<class _OdomData>
-  void PreIntegration(const char type,listeig(_OdomData) &mlOdom,
+  void PreIntegration(const char type,OdomStore<_OdomData> &mlOdom,
 		      typename listeig(_OdomData)::const_iterator &miterLastEnc,Frame *pLastF=NULL,Frame *pCurF=NULL);//0 for initialize,1 for inter-Frame PreInt.,2 for inter-KF PreInt. \
   0/2 also is used to cull the data in 2 lists whose tm is (mLastKeyFrame.mTimeStamp,mCurrentKeyFrame.mTimeStamp], \
   culling strategy: tm<mtmSyncOdom is discarded & tm>mCurrentFrame.mTimeStamp is reserved in lists & the left is needed for deltax~ij calculation, \
@@ -100,16 +105,30 @@ class Tracking
   //Variables
   std::chrono::steady_clock::time_point mtmGrabDelay;//for delay control(we found our Enc&IMU's response has some delay=20ms)
   //cache queue for vl,vr/IMU & its own timestamp from LastKF
-  listeig(EncData) mlOdomEnc;
-  listeig(IMUData) mlOdomIMU;
+  OdomStore<EncData> mlOdomEnc;
+  OdomStore<IMUData> mlOdomIMU;
   std::mutex mMutexOdom;//for 2 lists' multithreads' operation
+  //CacheOdom() only pushes into the rings, the Tracking thread moves their data into the 2 lists by DrainOdom() under mMutexOdom
+  OdomRing<EncData> mRingEnc;
+  OdomRing<IMUData> mRingIMU;
+  void DrainOdom();//mMutexOdom must be locked
+  //bounded retention(mMutexOdom must be locked): erase the Odom data older than needed, i.e. before the last KF(the former ones
+  //are already copied in the KFs), the 20 Frames after relocalization or the initial Frame of the monocular initialization
+  void TrimOdom();
+  template<class _OdomData>
+  void TrimOdomStore(OdomStore<_OdomData> &lOdom,typename listeig(_OdomData)::const_iterator &iterLast,const double &tmKeep);
+  template<class _OdomData>
+  void PushOdom(OdomRing<_OdomData> &ring,const _OdomData &data);//drains the rings itself when ring is full
+  std::mutex mMutexOdomWait;
+  std::condition_variable mCondOdom;//notified by CacheOdom() when mbOdomWaiting, Track() waits on it for the Odom data of mCurrentFrame
+  std::atomic<bool> mbOdomWaiting;
   listeig(EncData)::const_iterator miterLastEnc;//Last EncData pointer in LastFrame, need to check its tm and some data latter to find the min|mtmSyncOdom-tm| s.t. tm<=mtmSyncOdom
   listeig(IMUData)::const_iterator miterLastIMU;//Last IMUData pointer in LastFrame, we don't change the OdomData's content
   
   unsigned long mnLastOdomKFId;
 
 public:
-  //Add Odom(Enc/IMU) data to cache queue
+  //Add Odom(Enc/IMU) data to cache queue, lock-free: one producer thread per sensor(mRingEnc/mRingIMU), see System::TrackOdom()
   cv::Mat CacheOdom(const double &timestamp, const double* odomdata, const char mode);
    
   void SetLastKeyFrame(KeyFrame* pKF){
@@ -133,9 +152,25 @@ public:
              KeyFrameDatabase* pKFDB, const string &strSettingPath, const int sensor); 
 
     // Preprocess the input and call Track(). Extract features and performs stereo matching.
-    cv::Mat GrabImageStereo(const cv::Mat &imRectLeft,const cv::Mat &imRectRight, const double &timestamp);
-    cv::Mat GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp);
-    cv::Mat GrabImageMonocular(const cv::Mat &im, const double &timestamp);
+    //mask: optional dynamic mask(CV_8UC1, 0 means no features there) of this (left) image, combined with the static Camera.mask
+    cv::Mat GrabImageStereo(const cv::Mat &imRectLeft,const cv::Mat &imRectRight, const double &timestamp, const cv::Mat &mask=cv::Mat());
+    cv::Mat GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp, const cv::Mat &mask=cv::Mat());
+    cv::Mat GrabImageMonocular(const cv::Mat &im, const double &timestamp, const cv::Mat &mask=cv::Mat());
+
+    //optional pipelined mode(Tracking.PipelineDepth>0): GrabImageXXXAsync() only extracts the Frame on the caller's thread and queues it,
+    //the tracking thread of System consumes the queue by TrackPipelineFrame(), so the extraction of frame N+1 overlaps the tracking of frame N
+    enum ePipelineDrop{
+        PIPELINE_BLOCK=0,//the caller waits when the queue is full
+        PIPELINE_DROP_OLDEST=1//the oldest queued Frame is dropped with an empty pose
+    };
+    std::future<cv::Mat> GrabImageStereoAsync(const cv::Mat &imRectLeft,const cv::Mat &imRectRight, const double &timestamp, const cv::Mat &mask=cv::Mat());
+    std::future<cv::Mat> GrabImageRGBDAsync(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp, const cv::Mat &mask=cv::Mat());
+    std::future<cv::Mat> GrabImageMonocularAsync(const cv::Mat &im, const double &timestamp, const cv::Mat &mask=cv::Mat());
+    bool TrackPipelineFrame(std::promise<cv::Mat> &pose,cv::Mat &Tcw);//blocks for a queued Frame and tracks it, false when finished && empty
+    void SetPipelineIdle();//call after the pose of TrackPipelineFrame() is published
+    void WaitPipelineIdle();//blocks until all the queued Frames are tracked, then Reset()/InformOnlyTracking() can be called by the caller
+    void FinishPipeline();//the queued Frames are still tracked
+    int GetPipelineDepth() const{return mnPipelineDepth;}
 
     void SetLocalMapper(LocalMapping* pLocalMapper);
     void SetLoopClosing(LoopClosing* pLoopClosing);
@@ -194,7 +229,7 @@ public:
 
 protected:
     // Main tracking function. It is independent of the input sensor.
-    void Track(cv::Mat img[2]=NULL);//img[2] recorded by KFs
+    void Track(cv::Mat img[2]=NULL);//img[2] recorded by KFs, shallow here and cloned only for the new KFs
 
     // Map initialization for stereo and RGB-D
     void StereoInitialization(cv::Mat img[2]=NULL);
@@ -212,7 +247,7 @@ protected:
 
     bool Relocalization();
 
-    void UpdateLocalMap();//mpMap->SetReferenceMapPoints(mvpLocalMapPoints), UpdateLocalKeyFrames&&UpdateLocalPoints
+    void UpdateLocalMap();//mpMap->SetReferenceMapPoints(mvpLocalMapPoints), UpdateLocalKeyFrames&&UpdateLocalPoints&&SnapshotLocalMap
     void UpdateLocalPoints();//use mvpLocalKeyFrames[i]->mvpMapPoints to fill mvpLocalMapPoints(avoid duplications by pMP->mnTrackReferenceForFrame)
     void UpdateLocalKeyFrames();//use mCurrentFrame&&its covisible KFs(>=1 covisible MP)&&the KFs' neighbors(10 best covisibility KFs&&parent&&children) \
     to make mvpLocalKeyFrames, update (mCurrentFrame.)mpReferenceKF to max covisible KF
@@ -240,6 +275,50 @@ protected:
     //ORB
     ORBextractor* mpORBextractorLeft, *mpORBextractorRight;
     ORBextractor* mpIniORBextractor;
+    WorkerPool* mpExtractorPool;//shared by the extractors, the stereo Frame construction & the local map search(only when not pipelined), NULL when extraction is single-threaded
+
+    //optional latency budget: scale the features(then levels) of mpORBextractorLeft/Right so that the extraction+tracking+local map search
+    //of a frame stays within mdBudgetMs, the TrackLocalMap inliers are the floor
+    void AdaptFeatureBudget();
+    double mdBudgetMs;//<=0 means disabled
+    int mnMinFeatures,mnMaxFeatures,mnMinLevels,mnMaxLevels;
+    int mnMinInliersBudget;//features are increased instead of reduced when mnMatchesInliers is below it
+    double mdExtractCost,mdFrameCost;//ms, mdFrameCost is smoothed
+    std::chrono::steady_clock::time_point mtmTrackStart;//after the delay control of Track()
+
+    //optional hybrid KLT+ORB front end(RGB-D/Monocular): the frames between KFs track mLastFrame's inliers by optical flow,
+    //ORB is only extracted when a KF is near or the tracking gets weak
+    bool NeedFullExtraction();
+    bool GrabKLTFrame(const cv::Mat &im, const cv::Mat &imDepth, const double &timestamp, const cv::Mat &mask);//false if it must be extracted
+    void UpdateKLTPyramid();//after a full extraction
+    int KLTMatchesWithLastFrame();//for a KLT mCurrentFrame: the MapPoints it carries from mLastFrame(replaced ones updated, bad ones dropped)
+    bool mbKLT;
+    int mnKLTMinTracked;//full extraction when fewer inliers are tracked
+    bool mbNeedExtraction;//a KLT Frame wanted to be a KF, so the next one is extracted
+    bool mbKeyFrameNear;//set by NeedNewKeyFrame()
+    std::vector<cv::Mat> mvKLTPyramid;//optical flow pyramid of mLastFrame
+
+    //mCurrentFrame becomes mLastFrame by a move when the next image is grabbed instead of a deep copy at the end of Track()
+    void ShiftLastFrame();
+    bool mbLastFramePending;
+
+    struct PipelineFrame{//everything GrabImageXXX() passes to Track()
+      Frame frame;
+      cv::Mat imGray;//deep copied, the next extraction overwrites the pyramid
+      cv::Mat img[2];//RGB-D only
+      double dExtractCost;
+      std::chrono::steady_clock::time_point tmGrab;
+      std::promise<cv::Mat> pose;
+      EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+    std::future<cv::Mat> PushPipelineFrame(PipelineFrame* pPF);
+    int mnPipelineDepth;//max queued Frames, 0 means synchronous GrabImageXXX()
+    int mnPipelineDrop;//ePipelineDrop
+    std::deque<PipelineFrame*> mdPipeline;
+    bool mbPipelineBusy,mbPipelineFinish;
+    std::atomic<bool> mbIniExtraction;//monocular: the extraction stage uses mpIniORBextractor until the tracking stage is initialized
+    std::mutex mMutexPipeline;
+    std::condition_variable mCondPipeline;//for the producer, the consumer && WaitPipelineIdle()
 
     //BoW
     ORBVocabulary* mpORBVocabulary;
@@ -252,7 +331,19 @@ protected:
     KeyFrame* mpReferenceKF;//corresponding to mCurrentFrame(most of time ==mCurrentFrame.mpReferenceKF)
     std::vector<KeyFrame*> mvpLocalKeyFrames;
     std::vector<MapPoint*> mvpLocalMapPoints;
-    
+
+    //Track() doesn't hold mMutexMapUpdate during the tracking, only short holds: the initialization && CreateNewKeyFrame() commit to the map,
+    //SnapshotLocalMap() copies the local map TrackLocalMap() uses(MapPoint/KeyFrame::XXXTrack()), the trajectory is recorded at the end;
+    //the map version mCurrentFrame's pose belongs to is recorded in each hold, so it can be moved into a map corrected meanwhile
+    int mnPoseJumpIdxTrack;//mpMap->GetLastPoseJumpIdx()
+    double mdScaleTrack;//mpMap->GetScaleChange()
+    KeyFrame* mpRefKFTrack;//mpReferenceKF, NULL before the initialization
+    cv::Mat mTwrTrack;//mpRefKFTrack's pose inverse
+    bool mbVINSInitedTrack;//the tracking strategy of a frame doesn't change even if the IMU initialization finishes during it
+    void RecordMapVersion();//mMutexMapUpdate locked
+    void ReanchorCurrentFrame();//mMutexMapUpdate locked, move mCurrentFrame into the map corrected by a loop closure/GBA/scale update during its tracking
+    void SnapshotLocalMap();//reanchor mCurrentFrame && snapshot mvpLocalMapPoints,mCurrentFrame's MPs,mpLastKeyFrame's NavState under mMutexMapUpdate
+
     // System
     System* mpSystem;
     
@@ -301,54 +392,51 @@ protected:
 
 //created by zzh
 template<class EncData>
-bool Tracking::iterijFind(const listeig(EncData) &mlOdomEnc,const double &curTime,
+bool Tracking::iterijFind(const OdomStore<EncData> &mlOdomEnc,const double &curTime,
 			  typename listeig(EncData)::const_iterator &iter,const double&errOdomImg,bool bSearchBack){
-  typename listeig(EncData)::const_iterator iter1;//iter-1 or iter+1
+  //binary search on the time index of mlOdomEnc instead of walking the list
+  size_t pos=mlOdomEnc.Position(iter),pos1;//pos of iter, pos-1 or pos+1
+  const size_t N=mlOdomEnc.size();
   double minErr;//=errOdomImg+1;
   if (bSearchBack){//should==mlOdomEnc.end()
-    while (iter!=mlOdomEnc.begin()){//begin is min >= lastKFTime-err
-      if ((--iter)->mtm<=curTime) break;//get max <= curTime+0
-    }
+    pos=mlOdomEnc.UpperBound(curTime,0,pos);//get max <= curTime+0
+    if (pos>0) --pos;//else begin is min >= lastKFTime-err
     //Notice mlOdomEnc.empty()==false!
-//     if (iter!=mlOdomEnc.end()){//find a nearest iter to curTime
-      if (curTime>iter->mtm){//iter==begin may still have iter->mtm>curTime
-	minErr=curTime-iter->mtm;
-	iter1=iter;++iter1;//iter+1
-	if (iter1!=mlOdomEnc.end()&&(iter1->mtm-curTime<minErr)){
-	  iter=iter1;
-	  minErr=iter1->mtm-curTime;
-	}
-      }else{//we don't need to compare anything when iter->mtm>=curTime
-	minErr=iter->mtm-curTime;
+    if (curTime>mlOdomEnc.TimeAt(pos)){//iter==begin may still have iter->mtm>curTime
+      minErr=curTime-mlOdomEnc.TimeAt(pos);
+      pos1=pos+1;//iter+1
+      if (pos1<N&&(mlOdomEnc.TimeAt(pos1)-curTime<minErr)){
+	pos=pos1;
+	minErr=mlOdomEnc.TimeAt(pos1)-curTime;
       }
-//     }//==mlOdomEnc.end(), we cannot test ++iter
-  }else{//should==mlOdomEnc.begin()
-    while (iter!=mlOdomEnc.end()){//begin is min >= lastKFTime-err
-      if (iter->mtm>=curTime) break;//get min >= lastKFTime+0
-      ++iter;
+    }else{//we don't need to compare anything when iter->mtm>=curTime
+      minErr=mlOdomEnc.TimeAt(pos)-curTime;
     }
-    if (iter!=mlOdomEnc.end()){
-      minErr=iter->mtm-curTime;
-      if (iter!=mlOdomEnc.begin()){
-	iter1=iter;--iter1;//iter-1
-	if (curTime-iter1->mtm<minErr){
-	  iter=iter1;
-	  minErr=curTime-iter1->mtm;
+  }else{//should==mlOdomEnc.begin()
+    pos=mlOdomEnc.LowerBound(curTime,pos,N);//get min >= lastKFTime+0
+    if (pos<N){
+      minErr=mlOdomEnc.TimeAt(pos)-curTime;
+      if (pos>0){
+	pos1=pos-1;//iter-1
+	if (curTime-mlOdomEnc.TimeAt(pos1)<minErr){
+	  pos=pos1;
+	  minErr=curTime-mlOdomEnc.TimeAt(pos1);
 	}
       }
     }else{//==mlOdomEnc.end(), but we can test --iter
       //Notice mlOdomEnc.empty()==false!
-      --iter;
-      minErr=curTime-iter->mtm;
+      --pos;
+      minErr=curTime-mlOdomEnc.TimeAt(pos);
     }
   }
+  iter=mlOdomEnc.At(pos);
   if (minErr<=errOdomImg){//we found nearest allowed iterj/iteri to curTime/lastKFTime
     return true;
   }
   return false;//if iteri/j is not in allowed err, returned iter points to nearest one to curTime or end()
 }
 template<class EncData>
-void Tracking::PreIntegration(const char type,listeig(EncData) &mlOdomEnc,
+void Tracking::PreIntegration(const char type,OdomStore<EncData> &mlOdomEnc,
 			      typename listeig(EncData)::const_iterator &miterLastEnc,Frame *pLastF,Frame *pCurF){
   switch (type){//0/2 will cull 2 Odom lists,1 will shift the pointer
     case 0://for 0th keyframe/frame: erase all the data whose tm<=mCurrentFrame.mTimeStamp but keep the last one, like list.clear()
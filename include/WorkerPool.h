@@ -0,0 +1,43 @@
+//created by zzh
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <deque>
+#include <vector>
+
+namespace ORB_SLAM2
+{
+
+//long-lived threads executing submitted tasks, used instead of creating std::thread for every frame
+class WorkerPool
+{
+public:
+    explicit WorkerPool(int nThreads);
+    ~WorkerPool();//finishes the queued tasks then joins the workers
+
+    std::future<void> Submit(const std::function<void()> &task);
+    //block until fut is ready, executing queued tasks meanwhile, so a task can submit subtasks and Wait() them without deadlock
+    void Wait(std::future<void> &fut);
+
+    int GetThreadsNum() const{
+        return mvThreads.size();}
+
+protected:
+    void Run();//main loop of every worker
+    bool PopTask(std::function<void()> &task);//non-blocking
+
+    std::vector<std::thread> mvThreads;
+    std::deque<std::function<void()> > mdTasks;
+    std::mutex mMutexTasks;
+    std::condition_variable mCondTasks;
+    bool mbFinish;
+};
+
+} //namespace ORB_SLAM
+
+#endif // WORKERPOOL_H
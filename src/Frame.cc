@@ -22,6 +22,10 @@
 #include "Converter.h"
 #include "ORBmatcher.h"
 #include <thread>
+#include <climits>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 namespace ORB_SLAM2
 {
@@ -90,7 +94,7 @@ void Frame::PreIntegration<IMUData>(KeyFrame* pLastKF,const listeig(IMUData)::co
 #endif
 }
 
-Frame::Frame(istream &is,ORBVocabulary* voc):mpORBvocabulary(voc){//please don't forget voc!! Or ComputeBoW() will have a segement fault problem
+Frame::Frame(istream &is,ORBVocabulary* voc):mpORBvocabulary(voc),mbKLT(false){//please don't forget voc!! Or ComputeBoW() will have a segement fault problem
   mnId=nNextId++;//new Frame ID
   read(is);
   mvpMapPoints.resize(N,static_cast<MapPoint*>(NULL));//N is got in read(), very important allocation! for LoadMap()
@@ -139,7 +143,7 @@ bool Frame::read(istream &is,bool bOdomList){
   is.read((char*)pdData,sizeof(pdData));ns.mdbg<<pdData[0],pdData[1],pdData[2];//dbgxyz
   is.read((char*)pdData,sizeof(pdData));ns.mdba<<pdData[0],pdData[1],pdData[2];//dbaxyz
   mNavState=ns;UpdatePoseFromNS();
-  //load mGrid[i][j]
+  //make the grid
   AssignFeaturesToGrid();
   if (bOdomList){
     double &tmEnc=mOdomPreIntEnc.mdeltatij;
@@ -213,11 +217,13 @@ bool Frame::write(ostream &os) const{
   
 long unsigned int Frame::nNextId=0;
 bool Frame::mbInitialComputations=true;
+cv::Mat Frame::mUndistortLUT;
+bool Frame::mbUndistortLUTValid=false;
 float Frame::cx, Frame::cy, Frame::fx, Frame::fy, Frame::invfx, Frame::invfy;
 float Frame::mnMinX, Frame::mnMinY, Frame::mnMaxX, Frame::mnMaxY;
 float Frame::mfGridElementWidthInv, Frame::mfGridElementHeightInv;
 
-Frame::Frame()
+Frame::Frame():mbKLT(false)
 {}
 
 //Copy Constructor
@@ -228,16 +234,13 @@ Frame::Frame(const Frame &frame)
      mvKeysRight(frame.mvKeysRight), mvKeysUn(frame.mvKeysUn),  mvuRight(frame.mvuRight),
      mvDepth(frame.mvDepth), mBowVec(frame.mBowVec), mFeatVec(frame.mFeatVec),
      mDescriptors(frame.mDescriptors.clone()), mDescriptorsRight(frame.mDescriptorsRight.clone()),
-     mvpMapPoints(frame.mvpMapPoints), mvbOutlier(frame.mvbOutlier), mnId(frame.mnId),
+     mvpMapPoints(frame.mvpMapPoints), mvbOutlier(frame.mvbOutlier), mbKLT(frame.mbKLT),
+     mvGridIndices(frame.mvGridIndices), mvGridStart(frame.mvGridStart), mnId(frame.mnId),
      mpReferenceKF(frame.mpReferenceKF), mnScaleLevels(frame.mnScaleLevels),
      mfScaleFactor(frame.mfScaleFactor), mfLogScaleFactor(frame.mfLogScaleFactor),
      mvScaleFactors(frame.mvScaleFactors), mvInvScaleFactors(frame.mvInvScaleFactors),
      mvLevelSigma2(frame.mvLevelSigma2), mvInvLevelSigma2(frame.mvInvLevelSigma2)
 {
-    for(int i=0;i<FRAME_GRID_COLS;i++)
-        for(int j=0; j<FRAME_GRID_ROWS; j++)
-            mGrid[i][j]=frame.mGrid[i][j];
-
     if(!frame.mTcw.empty())
         SetPose(frame.mTcw);
     
@@ -250,10 +253,11 @@ Frame::Frame(const Frame &frame)
 }
 
 
-Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth)
+Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, const cv::Mat &mask)
     :mpORBvocabulary(voc),mpORBextractorLeft(extractorLeft),mpORBextractorRight(extractorRight), mTimeStamp(timeStamp), mK(K.clone()),mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth),
      mpReferenceKF(static_cast<KeyFrame*>(NULL)),
-     mbPrior(false)//zzh
+     mbPrior(false),//zzh
+     mbKLT(false)
 {
     // Frame ID
     mnId=nNextId++;
@@ -268,10 +272,20 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
     mvInvLevelSigma2 = mpORBextractorLeft->GetInverseScaleSigmaSquares();
 
     // ORB extraction
-    thread threadLeft(&Frame::ExtractORB,this,0,imLeft);
-    thread threadRight(&Frame::ExtractORB,this,1,imRight);
-    threadLeft.join();
-    threadRight.join();
+    WorkerPool* pWorkerPool = mpORBextractorLeft->GetWorkerPool();
+    if(pWorkerPool)//the right image goes to the long-lived workers, the left one is extracted here
+    {
+        future<void> futRight = pWorkerPool->Submit(bind(&Frame::ExtractORB,this,1,imRight,cv::Mat()));
+        ExtractORB(0,imLeft,mask);
+        pWorkerPool->Wait(futRight);
+    }
+    else
+    {
+        thread threadLeft(&Frame::ExtractORB,this,0,imLeft,mask);
+        thread threadRight(&Frame::ExtractORB,this,1,imRight,cv::Mat());
+        threadLeft.join();
+        threadRight.join();
+    }
 
     N = mvKeys.size();
 
@@ -309,10 +323,11 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
     AssignFeaturesToGrid();
 }
 
-Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth)
+Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const float &depthFactor, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, const cv::Mat &mask)
     :mpORBvocabulary(voc),mpORBextractorLeft(extractor),mpORBextractorRight(static_cast<ORBextractor*>(NULL)),
      mTimeStamp(timeStamp), mK(K.clone()),mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth),
-     mbPrior(false)//zzh
+     mbPrior(false),//zzh
+     mbKLT(false)
 {
     // Frame ID
     mnId=nNextId++;
@@ -327,7 +342,7 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeSt
     mvInvLevelSigma2 = mpORBextractorLeft->GetInverseScaleSigmaSquares();
 
     // ORB extraction
-    ExtractORB(0,imGray);
+    ExtractORB(0,imGray,mask);
 
     N = mvKeys.size();
 
@@ -336,7 +351,7 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeSt
 
     UndistortKeyPoints();
 
-    ComputeStereoFromRGBD(imDepth);
+    ComputeStereoFromRGBD(imDepth,depthFactor);
 
     mvpMapPoints = vector<MapPoint*>(N,static_cast<MapPoint*>(NULL));//for directly associated vector type mvpMapPoints,used in KF::AddMapPiont()
     mvbOutlier = vector<bool>(N,false);
@@ -366,10 +381,11 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeSt
 }
 
 
-Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth)
+Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, const cv::Mat &mask)
     :mpORBvocabulary(voc),mpORBextractorLeft(extractor),mpORBextractorRight(static_cast<ORBextractor*>(NULL)),
      mTimeStamp(timeStamp), mK(K.clone()),mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth),
-     mbPrior(false)//zzh
+     mbPrior(false),//zzh
+     mbKLT(false)
 {
     // Frame ID
     mnId=nNextId++;
@@ -384,7 +400,7 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extra
     mvInvLevelSigma2 = mpORBextractorLeft->GetInverseScaleSigmaSquares();
 
     // ORB extraction
-    ExtractORB(0,imGray);
+    ExtractORB(0,imGray,mask);
 
     N = mvKeys.size();
 
@@ -425,27 +441,122 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extra
 
 void Frame::AssignFeaturesToGrid()
 {
-    int nReserve = 0.5f*N/(FRAME_GRID_COLS*FRAME_GRID_ROWS);
-    for(unsigned int i=0; i<FRAME_GRID_COLS;i++)
-        for (unsigned int j=0; j<FRAME_GRID_ROWS;j++)
-            mGrid[i][j].reserve(nReserve);
-
+    //counting sort of the keypoints by cell, stable so the indices of a cell stay ascending
+    const int nCells = FRAME_GRID_COLS*FRAME_GRID_ROWS;
+    vector<int> vCellOfKey(N);
+    mvGridStart.assign(nCells+1,0);
     for(int i=0;i<N;i++)
     {
         const cv::KeyPoint &kp = mvKeysUn[i];
 
         int nGridPosX, nGridPosY;
         if(PosInGrid(kp,nGridPosX,nGridPosY))
-            mGrid[nGridPosX][nGridPosY].push_back(i);
+        {
+            vCellOfKey[i] = nGridPosX*FRAME_GRID_ROWS+nGridPosY;
+            ++mvGridStart[vCellOfKey[i]+1];
+        }
+        else
+            vCellOfKey[i] = -1;
     }
+    for(int c=0;c<nCells;c++)
+        mvGridStart[c+1] += mvGridStart[c];
+
+    mvGridIndices.resize(mvGridStart[nCells]);
+    vector<int> vFill(mvGridStart.begin(),mvGridStart.end()-1);
+    for(int i=0;i<N;i++)
+        if(vCellOfKey[i]>=0)
+            mvGridIndices[vFill[vCellOfKey[i]]++] = i;
+}
+
+Frame::Frame(const vector<cv::Mat> &vPyrLast, const vector<cv::Mat> &vPyr, const cv::Mat &imDepth, const float &depthFactor, const double &timeStamp, const Frame &lastFrame, const cv::Mat &mask)
+    :mpORBvocabulary(lastFrame.mpORBvocabulary),mpORBextractorLeft(lastFrame.mpORBextractorLeft),mpORBextractorRight(lastFrame.mpORBextractorRight),
+     mTimeStamp(timeStamp), mK(lastFrame.mK.clone()),mDistCoef(lastFrame.mDistCoef.clone()), mbf(lastFrame.mbf), mThDepth(lastFrame.mThDepth),
+     mpReferenceKF(static_cast<KeyFrame*>(NULL)), mnScaleLevels(lastFrame.mnScaleLevels),
+     mfScaleFactor(lastFrame.mfScaleFactor), mfLogScaleFactor(lastFrame.mfLogScaleFactor),
+     mvScaleFactors(lastFrame.mvScaleFactors), mvInvScaleFactors(lastFrame.mvInvScaleFactors),
+     mvLevelSigma2(lastFrame.mvLevelSigma2), mvInvLevelSigma2(lastFrame.mvInvLevelSigma2),
+     mbPrior(false),//zzh
+     mbKLT(true)
+{
+    // Frame ID
+    mnId=nNextId++;
+
+    // Only the keypoints of the inlier MapPoints are tracked, the others are useless for the pose
+    vector<int> vIdxLast;
+    vector<cv::Point2f> vPtsLast;
+    vIdxLast.reserve(lastFrame.N);
+    vPtsLast.reserve(lastFrame.N);
+    for(int i=0; i<lastFrame.N; i++)
+    {
+        if(lastFrame.mvpMapPoints[i] && !lastFrame.mvbOutlier[i])
+        {
+            vIdxLast.push_back(i);
+            vPtsLast.push_back(lastFrame.mvKeys[i].pt);
+        }
+    }
+
+    N = 0;
+    if(!vPtsLast.empty())
+    {
+        const cv::Size winSize(KLT_WIN_SIZE,KLT_WIN_SIZE);
+        const cv::TermCriteria criteria(cv::TermCriteria::COUNT+cv::TermCriteria::EPS,30,0.01);
+        vector<cv::Point2f> vPts, vPtsBack=vPtsLast;
+        vector<uchar> vStatus, vStatusBack;
+        vector<float> vErr;
+        cv::calcOpticalFlowPyrLK(vPyrLast,vPyr,vPtsLast,vPts,vStatus,vErr,winSize,KLT_MAX_LEVEL,criteria);
+        //forward-backward check: the point tracked back must return to where it was
+        cv::calcOpticalFlowPyrLK(vPyr,vPyrLast,vPts,vPtsBack,vStatusBack,vErr,winSize,KLT_MAX_LEVEL,criteria,cv::OPTFLOW_USE_INITIAL_FLOW);
+
+        const float maxX = vPyr[0].cols-1, maxY = vPyr[0].rows-1;
+        const bool bMask = !mask.empty() && mask.type()==CV_8UC1 && mask.size()==vPyr[0].size();//a wrong mask is ignored as in ORBextractor
+        mvKeys.reserve(vPts.size());
+        mvpMapPoints.reserve(vPts.size());
+        mDescriptors.create(vPts.size(),lastFrame.mDescriptors.cols,lastFrame.mDescriptors.type());
+        for(size_t k=0; k<vPts.size(); k++)
+        {
+            if(!vStatus[k] || !vStatusBack[k])
+                continue;
+            const cv::Point2f &pt = vPts[k];
+            const cv::Point2f d = vPtsBack[k]-vPtsLast[k];
+            if(d.x*d.x+d.y*d.y>1.f || pt.x<0 || pt.y<0 || pt.x>maxX || pt.y>maxY)
+                continue;
+            if(bMask && !mask.at<uchar>(cvRound(pt.y),cvRound(pt.x)))
+                continue;
+            cv::KeyPoint kp = lastFrame.mvKeys[vIdxLast[k]];//octave & angle are kept, the scale changes little between 2 frames
+            kp.pt = pt;
+            mvKeys.push_back(kp);
+            mvpMapPoints.push_back(lastFrame.mvpMapPoints[vIdxLast[k]]);//the flow gives the correspondence with lastFrame
+            lastFrame.mDescriptors.row(vIdxLast[k]).copyTo(mDescriptors.row(N++));
+        }
+        mDescriptors = mDescriptors.rowRange(0,N);
+    }
+
+    if(mvKeys.empty())
+        return;
+
+    UndistortKeyPoints();
+
+    if(imDepth.empty())
+    {
+        mvuRight = vector<float>(N,-1);
+        mvDepth = vector<float>(N,-1);
+    }
+    else
+        ComputeStereoFromRGBD(imDepth,depthFactor);
+
+    mvbOutlier = vector<bool>(N,false);
+
+    mb = mbf/fx;
+
+    AssignFeaturesToGrid();
 }
 
-void Frame::ExtractORB(int flag, const cv::Mat &im)
+void Frame::ExtractORB(int flag, const cv::Mat &im, const cv::Mat &mask)
 {
     if(flag==0)
-        (*mpORBextractorLeft)(im,cv::Mat(),mvKeys,mDescriptors);
+        (*mpORBextractorLeft)(im,mask,mvKeys,mDescriptors);
     else
-        (*mpORBextractorRight)(im,cv::Mat(),mvKeysRight,mDescriptorsRight);
+        (*mpORBextractorRight)(im,mask,mvKeysRight,mDescriptorsRight);
 }
 
 void Frame::SetPose(cv::Mat Tcw)
@@ -520,9 +631,130 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
     return true;
 }
 
+int Frame::isInFrustum(const vector<MapPoint*> &vpMPs, float viewingCosLimit, vector<MapPoint*> &vpInView)
+{
+    vpInView.clear();
+    const int n = vpMPs.size();
+    if(n==0)
+        return 0;
+
+    // Snapshot(SoA): 0~2 world position, 3~5 normal, 6 min distance, 7 max distance
+    vector<float> vData(8*n);
+    float *pX=&vData[0], *pY=pX+n, *pZ=pY+n, *pNx=pZ+n, *pNy=pNx+n, *pNz=pNy+n, *pMinD=pNz+n, *pMaxD=pMinD+n;
+    for(int i=0; i<n; i++)
+    {
+        MapPoint* pMP = vpMPs[i];
+        pMP->mbTrackInView = false;
+        float P[3],Pn[3];
+        pMP->GetFrustumDataTrack(P,Pn,pMinD[i],pMaxD[i]);
+        pX[i]=P[0]; pY[i]=P[1]; pZ[i]=P[2];
+        pNx[i]=Pn[0]; pNy[i]=Pn[1]; pNz[i]=Pn[2];
+    }
+
+    const float r00=mRcw.at<float>(0,0), r01=mRcw.at<float>(0,1), r02=mRcw.at<float>(0,2);
+    const float r10=mRcw.at<float>(1,0), r11=mRcw.at<float>(1,1), r12=mRcw.at<float>(1,2);
+    const float r20=mRcw.at<float>(2,0), r21=mRcw.at<float>(2,1), r22=mRcw.at<float>(2,2);
+    const float t0=mtcw.at<float>(0), t1=mtcw.at<float>(1), t2=mtcw.at<float>(2);
+    const float o0=mOw.at<float>(0), o1=mOw.at<float>(1), o2=mOw.at<float>(2);
+
+    // Results: u, v, invz, dist, viewCos and the visibility
+    vector<float> vRes(5*n);
+    float *pU=&vRes[0], *pV=pU+n, *pInvz=pV+n, *pDist=pInvz+n, *pCos=pDist+n;
+    vector<unsigned char> vbIn(n);
+
+    int i=0;
+#ifdef __AVX2__
+    for(; i+8<=n; i+=8)//the checks of isInFrustum() with the same(unordered) comparisons
+    {
+        const __m256 X=_mm256_loadu_ps(pX+i), Y=_mm256_loadu_ps(pY+i), Z=_mm256_loadu_ps(pZ+i);
+        const __m256 PcX=_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(r00),X),_mm256_mul_ps(_mm256_set1_ps(r01),Y)),
+                                       _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(r02),Z),_mm256_set1_ps(t0)));
+        const __m256 PcY=_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(r10),X),_mm256_mul_ps(_mm256_set1_ps(r11),Y)),
+                                       _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(r12),Z),_mm256_set1_ps(t1)));
+        const __m256 PcZ=_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(r20),X),_mm256_mul_ps(_mm256_set1_ps(r21),Y)),
+                                       _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(r22),Z),_mm256_set1_ps(t2)));
+        __m256 in=_mm256_cmp_ps(PcZ,_mm256_setzero_ps(),_CMP_NLT_UQ);
+
+        const __m256 invz=_mm256_div_ps(_mm256_set1_ps(1.0f),PcZ);
+        const __m256 u=_mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(fx),PcX),invz),_mm256_set1_ps(cx));
+        const __m256 v=_mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(fy),PcY),invz),_mm256_set1_ps(cy));
+        in=_mm256_and_ps(in,_mm256_and_ps(_mm256_cmp_ps(u,_mm256_set1_ps(mnMinX),_CMP_NLT_UQ),_mm256_cmp_ps(u,_mm256_set1_ps(mnMaxX),_CMP_NGT_UQ)));
+        in=_mm256_and_ps(in,_mm256_and_ps(_mm256_cmp_ps(v,_mm256_set1_ps(mnMinY),_CMP_NLT_UQ),_mm256_cmp_ps(v,_mm256_set1_ps(mnMaxY),_CMP_NGT_UQ)));
+
+        const __m256 POx=_mm256_sub_ps(X,_mm256_set1_ps(o0)), POy=_mm256_sub_ps(Y,_mm256_set1_ps(o1)), POz=_mm256_sub_ps(Z,_mm256_set1_ps(o2));
+        const __m256 dist=_mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(POx,POx),_mm256_mul_ps(POy,POy)),_mm256_mul_ps(POz,POz)));
+        const __m256 minD=_mm256_mul_ps(_mm256_set1_ps(0.8f),_mm256_loadu_ps(pMinD+i));
+        const __m256 maxD=_mm256_mul_ps(_mm256_set1_ps(1.2f),_mm256_loadu_ps(pMaxD+i));
+        in=_mm256_and_ps(in,_mm256_and_ps(_mm256_cmp_ps(dist,minD,_CMP_NLT_UQ),_mm256_cmp_ps(dist,maxD,_CMP_NGT_UQ)));
+
+        const __m256 dot=_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(POx,_mm256_loadu_ps(pNx+i)),_mm256_mul_ps(POy,_mm256_loadu_ps(pNy+i))),
+                                       _mm256_mul_ps(POz,_mm256_loadu_ps(pNz+i)));
+        const __m256 viewCos=_mm256_div_ps(dot,dist);
+        in=_mm256_and_ps(in,_mm256_cmp_ps(viewCos,_mm256_set1_ps(viewingCosLimit),_CMP_NLT_UQ));
+
+        _mm256_storeu_ps(pU+i,u);
+        _mm256_storeu_ps(pV+i,v);
+        _mm256_storeu_ps(pInvz+i,invz);
+        _mm256_storeu_ps(pDist+i,dist);
+        _mm256_storeu_ps(pCos+i,viewCos);
+        const int mask=_mm256_movemask_ps(in);
+        for(int k=0; k<8; k++)
+            vbIn[i+k]=(mask>>k)&1;
+    }
+#endif
+    for(; i<n; i++)
+    {
+        vbIn[i]=0;
+        const float PcX=r00*pX[i]+r01*pY[i]+r02*pZ[i]+t0;
+        const float PcY=r10*pX[i]+r11*pY[i]+r12*pZ[i]+t1;
+        const float PcZ=r20*pX[i]+r21*pY[i]+r22*pZ[i]+t2;
+        if(PcZ<0.0f)
+            continue;
+        pInvz[i]=1.0f/PcZ;
+        pU[i]=fx*PcX*pInvz[i]+cx;
+        pV[i]=fy*PcY*pInvz[i]+cy;
+        if(pU[i]<mnMinX || pU[i]>mnMaxX || pV[i]<mnMinY || pV[i]>mnMaxY)
+            continue;
+        const float POx=pX[i]-o0, POy=pY[i]-o1, POz=pZ[i]-o2;
+        pDist[i]=sqrt(POx*POx+POy*POy+POz*POz);
+        if(pDist[i]<0.8f*pMinD[i] || pDist[i]>1.2f*pMaxD[i])
+            continue;
+        pCos[i]=(POx*pNx[i]+POy*pNy[i]+POz*pNz[i])/pDist[i];
+        if(pCos[i]<viewingCosLimit)
+            continue;
+        vbIn[i]=1;
+    }
+
+    // Data used by the tracking, the scale is predicted like MapPoint::PredictScale() with the snapshot
+    vpInView.reserve(n);
+    for(int i=0; i<n; i++)
+    {
+        if(!vbIn[i])
+            continue;
+        int nPredictedLevel = ceil(log(pMaxD[i]/pDist[i])/mfLogScaleFactor);
+        if(nPredictedLevel<0)
+            nPredictedLevel = 0;
+        else if(nPredictedLevel>=mnScaleLevels)
+            nPredictedLevel = mnScaleLevels-1;
+
+        MapPoint* pMP = vpMPs[i];
+        pMP->mbTrackInView = true;
+        pMP->mTrackProjX = pU[i];
+        pMP->mTrackProjXR = pU[i] - mbf*pInvz[i];
+        pMP->mTrackProjY = pV[i];
+        pMP->mnTrackScaleLevel= nPredictedLevel;
+        pMP->mTrackViewCos = pCos[i];
+        vpInView.push_back(pMP);
+    }
+
+    return vpInView.size();
+}
+
 vector<size_t> Frame::GetFeaturesInArea(const float &x, const float  &y, const float  &r, const int minLevel, const int maxLevel) const
 {
     vector<size_t> vIndices;
+    if(mvGridStart.empty())
+        return vIndices;
     vIndices.reserve(N);
 
     const int nMinCellX = max(0,(int)floor((x-mnMinX-r)*mfGridElementWidthInv));
@@ -545,30 +777,26 @@ vector<size_t> Frame::GetFeaturesInArea(const float &x, const float  &y, const f
 
     for(int ix = nMinCellX; ix<=nMaxCellX; ix++)
     {
-        for(int iy = nMinCellY; iy<=nMaxCellY; iy++)
+        //cells [nMinCellY,nMaxCellY] of column ix are one contiguous range
+        const int* pIdx = mvGridIndices.data() + mvGridStart[ix*FRAME_GRID_ROWS+nMinCellY];
+        const int* pIdxEnd = mvGridIndices.data() + mvGridStart[ix*FRAME_GRID_ROWS+nMaxCellY+1];
+        for(; pIdx!=pIdxEnd; ++pIdx)
         {
-            const vector<size_t> vCell = mGrid[ix][iy];
-            if(vCell.empty())
-                continue;
-
-            for(size_t j=0, jend=vCell.size(); j<jend; j++)
+            const cv::KeyPoint &kpUn = mvKeysUn[*pIdx];
+            if(bCheckLevels)//if the octave is out of level range
             {
-                const cv::KeyPoint &kpUn = mvKeysUn[vCell[j]];
-                if(bCheckLevels)//if the octave is out of level range
-                {
-                    if(kpUn.octave<minLevel)//-1 is also ok,0 cannot be true
+                if(kpUn.octave<minLevel)//-1 is also ok,0 cannot be true
+                    continue;
+                if(maxLevel>=0)//avoid for -1
+                    if(kpUn.octave>maxLevel)
                         continue;
-                    if(maxLevel>=0)//avoid for -1
-                        if(kpUn.octave>maxLevel)
-                            continue;
-                }
+            }
 
-                const float distx = kpUn.pt.x-x;
-                const float disty = kpUn.pt.y-y;
+            const float distx = kpUn.pt.x-x;
+            const float disty = kpUn.pt.y-y;
 
-                if(fabs(distx)<r && fabs(disty)<r)//find the features in a rectangle window whose centre is (x,y)
-                    vIndices.push_back(vCell[j]);
-            }
+            if(fabs(distx)<r && fabs(disty)<r)//find the features in a rectangle window whose centre is (x,y)
+                vIndices.push_back(*pIdx);
         }
     }
 
@@ -597,6 +825,26 @@ void Frame::ComputeBoW()
     }
 }
 
+void Frame::ComputeUndistortLUT(const cv::Mat &K, const cv::Mat &distCoef, const int cols, const int rows)
+{
+    if(mbUndistortLUTValid && mUndistortLUT.rows==rows+1 && mUndistortLUT.cols==cols+1)
+        return;
+
+    // Fill matrix with all the integer positions, the iterative solve of cv::undistortPoints is only paid here
+    cv::Mat mat((rows+1)*(cols+1),1,CV_32FC2);
+    float *pt = mat.ptr<float>();
+    for(int y=0; y<=rows; y++)
+        for(int x=0; x<=cols; x++, pt+=2)
+        {
+            pt[0] = x;
+            pt[1] = y;
+        }
+
+    cv::undistortPoints(mat,mat,K,distCoef,cv::Mat(),K);
+    mUndistortLUT = mat.reshape(2,rows+1);
+    mbUndistortLUTValid = true;
+}
+
 void Frame::UndistortKeyPoints()
 {
     if(mDistCoef.at<float>(0)==0.0)
@@ -605,26 +853,28 @@ void Frame::UndistortKeyPoints()
         return;
     }
 
-    // Fill matrix with points
-    cv::Mat mat(N,2,CV_32F);
-    for(int i=0; i<N; i++)
-    {
-        mat.at<float>(i,0)=mvKeys[i].pt.x;
-        mat.at<float>(i,1)=mvKeys[i].pt.y;
-    }
-
-    // Undistort points
-    mat=mat.reshape(2);
-    cv::undistortPoints(mat,mat,mK,mDistCoef,cv::Mat(),mK);
-    mat=mat.reshape(1);
+    const cv::Mat &im = mpORBextractorLeft->mvImagePyramid[0];
+    ComputeUndistortLUT(mK,mDistCoef,im.cols,im.rows);//only when Tracking hasn't built it for this size
 
-    // Fill undistorted keypoint vector
+    // Fill undistorted keypoint vector by bilinear lookup
+    const int cols = mUndistortLUT.cols-1;
+    const int rows = mUndistortLUT.rows-1;
     mvKeysUn.resize(N);
     for(int i=0; i<N; i++)
     {
         cv::KeyPoint kp = mvKeys[i];
-        kp.pt.x=mat.at<float>(i,0);
-        kp.pt.y=mat.at<float>(i,1);
+        const float x = min(max(kp.pt.x,0.0f),(float)cols);
+        const float y = min(max(kp.pt.y,0.0f),(float)rows);
+        const int x0 = min((int)x,cols-1);
+        const int y0 = min((int)y,rows-1);
+        const float ax = x-x0;
+        const float ay = y-y0;
+
+        const float *p0 = mUndistortLUT.ptr<float>(y0)+2*x0;//(x0,y0),(x0+1,y0)
+        const float *p1 = mUndistortLUT.ptr<float>(y0+1)+2*x0;//(x0,y0+1),(x0+1,y0+1)
+        const float w00 = (1.0f-ax)*(1.0f-ay), w01 = ax*(1.0f-ay), w10 = (1.0f-ax)*ay, w11 = ax*ay;
+        kp.pt.x = w00*p0[0]+w01*p0[2]+w10*p1[0]+w11*p1[2];
+        kp.pt.y = w00*p0[1]+w01*p0[3]+w10*p1[1]+w11*p1[3];
         mvKeysUn[i]=kp;
     }
 }
@@ -633,21 +883,19 @@ void Frame::ComputeImageBounds(const cv::Mat &imLeft)
 {
     if(mDistCoef.at<float>(0)!=0.0)
     {
-        cv::Mat mat(4,2,CV_32F);
-        mat.at<float>(0,0)=0.0; mat.at<float>(0,1)=0.0;
-        mat.at<float>(1,0)=imLeft.cols; mat.at<float>(1,1)=0.0;
-        mat.at<float>(2,0)=0.0; mat.at<float>(2,1)=imLeft.rows;
-        mat.at<float>(3,0)=imLeft.cols; mat.at<float>(3,1)=imLeft.rows;
-
-        // Undistort corners
-        mat=mat.reshape(2);
-        cv::undistortPoints(mat,mat,mK,mDistCoef,cv::Mat(),mK);
-        mat=mat.reshape(1);
-
-        mnMinX = min(mat.at<float>(0,0),mat.at<float>(2,0));
-        mnMaxX = max(mat.at<float>(1,0),mat.at<float>(3,0));
-        mnMinY = min(mat.at<float>(0,1),mat.at<float>(1,1));
-        mnMaxY = max(mat.at<float>(2,1),mat.at<float>(3,1));
+        // Undistorted corners are the corners of the lookup table
+        ComputeUndistortLUT(mK,mDistCoef,imLeft.cols,imLeft.rows);
+        const int cols = imLeft.cols;
+        const int rows = imLeft.rows;
+        const cv::Vec2f &tl = mUndistortLUT.at<cv::Vec2f>(0,0);
+        const cv::Vec2f &tr = mUndistortLUT.at<cv::Vec2f>(0,cols);
+        const cv::Vec2f &bl = mUndistortLUT.at<cv::Vec2f>(rows,0);
+        const cv::Vec2f &br = mUndistortLUT.at<cv::Vec2f>(rows,cols);
+
+        mnMinX = min(tl[0],bl[0]);
+        mnMaxX = max(tr[0],br[0]);
+        mnMinY = min(tl[1],tr[1]);
+        mnMaxY = max(bl[1],br[1]);
 
     }
     else
@@ -664,49 +912,143 @@ void Frame::ComputeStereoMatches()
     mvuRight = vector<float>(N,-1.0f);
     mvDepth = vector<float>(N,-1.0f);
 
-    const int thOrbDist = (ORBmatcher::TH_HIGH+ORBmatcher::TH_LOW)/2;
-
     const int nRows = mpORBextractorLeft->mvImagePyramid[0].rows;
 
-    //Assign keypoints to row table
-    vector<vector<size_t> > vRowIndices(nRows,vector<size_t>());
-
-    for(int i=0; i<nRows; i++)
-        vRowIndices[i].reserve(200);
-
+    //Assign keypoints to row table, flat: the candidates of row y are vRowIndices[vRowStart[y],vRowStart[y+1])
     const int Nr = mvKeysRight.size();
+    vector<int> vMinRow(Nr),vMaxRow(Nr);
+    vector<int> vRowStart(nRows+1,0);
 
     for(int iR=0; iR<Nr; iR++)
     {
         const cv::KeyPoint &kp = mvKeysRight[iR];
         const float &kpY = kp.pt.y;
         const float r = 2.0f*mvScaleFactors[mvKeysRight[iR].octave];
-        const int maxr = ceil(kpY+r);
-        const int minr = floor(kpY-r);
+        vMinRow[iR] = max((int)floor(kpY-r),0);
+        vMaxRow[iR] = min((int)ceil(kpY+r),nRows-1);
 
-        for(int yi=minr;yi<=maxr;yi++)
-            vRowIndices[yi].push_back(iR);
+        for(int yi=vMinRow[iR];yi<=vMaxRow[iR];yi++)
+            vRowStart[yi+1]++;
     }
+    for(int yi=0; yi<nRows; yi++)
+        vRowStart[yi+1]+=vRowStart[yi];
+
+    vector<int> vRowIndices(vRowStart[nRows]);
+    {
+        vector<int> vRowFill(vRowStart.begin(),vRowStart.end()-1);
+        for(int iR=0; iR<Nr; iR++)//keeps the ascending iR order of every row
+            for(int yi=vMinRow[iR];yi<=vMaxRow[iR];yi++)
+                vRowIndices[vRowFill[yi]++]=iR;
+    }
+
+    // For each left keypoint search a match in the right image, the left keypoints are split into bands for the extractors' workers
+    WorkerPool* pWorkerPool = mpORBextractorLeft->GetWorkerPool();
+    const int nMinBand = 128;
+    int nBands = pWorkerPool ? min(pWorkerPool->GetThreadsNum()+1,N/nMinBand) : 1;
+    if(nBands<1)
+        nBands=1;
+    vector<vector<pair<int,int> > > vvDistIdx(nBands);
+    vector<future<void> > vFutures;
+    for(int b=1; b<nBands; b++)
+        vFutures.push_back(pWorkerPool->Submit(bind(&Frame::ComputeStereoMatchesBand,this,cref(vRowStart),cref(vRowIndices),
+                                                    N*b/nBands,N*(b+1)/nBands,ref(vvDistIdx[b]))));
+    ComputeStereoMatchesBand(vRowStart,vRowIndices,0,N/nBands,vvDistIdx[0]);
+    for(size_t i=0; i<vFutures.size(); i++)
+        pWorkerPool->Wait(vFutures[i]);
+
+    vector<pair<int, int> > vDistIdx;
+    vDistIdx.swap(vvDistIdx[0]);
+    for(int b=1; b<nBands; b++)
+        vDistIdx.insert(vDistIdx.end(),vvDistIdx[b].begin(),vvDistIdx[b].end());
+    if(vDistIdx.empty())
+        return;
+
+    sort(vDistIdx.begin(),vDistIdx.end());
+    const float median = vDistIdx[vDistIdx.size()/2].first;
+    const float thDist = 1.5f*1.4f*median;
+
+    for(int i=vDistIdx.size()-1;i>=0;i--)
+    {
+        if(vDistIdx[i].first<thDist)
+            break;
+        else
+        {
+            mvuRight[vDistIdx[i].second]=-1;
+            mvDepth[vDistIdx[i].second]=-1;
+        }
+    }
+}
+
+//SAD of the (2w+1)x(2w+1) window pL(centre subtracted) against the 2L+1 windows of pR shifted by 0..2L pixels(centres subtracted),
+//pL/pR point to the top-left pixel of the first windows, the 16 lanes of an AVX2 register hold all shifts of one pixel at once
+static void StereoWindowSAD(const uchar* pL, const size_t stepL, const uchar* pR, const size_t stepR, const uchar* pRLimit, int* dists)
+{
+    const int w = 5;
+    const int L = 5;
+    const int cL = pL[w*stepL+w];
+#ifdef __AVX2__
+    if(pR+(2*w)*stepR+2*w+16<=pRLimit)//the last row's loads stay in the image buffer
+    {
+        const __m256i vcR = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(pR+w*stepR+w)));
+        __m256i vAcc = _mm256_setzero_si256();//<=(2w+1)^2*510<65536
+        for(int r=0; r<=2*w; r++, pL+=stepL, pR+=stepR)
+        {
+            for(int j=0; j<=2*w; j++)
+            {
+                const __m256i vR = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(pR+j))),vcR);
+                const __m256i vL = _mm256_set1_epi16((short)(pL[j]-cL));
+                vAcc = _mm256_add_epi16(vAcc,_mm256_abs_epi16(_mm256_sub_epi16(vR,vL)));
+            }
+        }
+        unsigned short CV_DECL_ALIGNED(32) acc[16];
+        _mm256_store_si256((__m256i*)acc,vAcc);
+        for(int k=0; k<=2*L; k++)
+            dists[k]=acc[k];
+        return;
+    }
+#endif
+    for(int k=0; k<=2*L; k++)
+        dists[k]=0;
+    for(int k=0; k<=2*L; k++)
+    {
+        const int cR = pR[w*stepR+w+k];
+        const uchar* pl = pL;
+        const uchar* pr = pR+k;
+        int dist=0;
+        for(int r=0; r<=2*w; r++, pl+=stepL, pr+=stepR)
+            for(int j=0; j<=2*w; j++)
+                dist+=abs((pl[j]-cL)-(pr[j]-cR));
+        dists[k]=dist;
+    }
+}
+
+void Frame::ComputeStereoMatchesBand(const vector<int> &vRowStart, const vector<int> &vRowIndices, const int iBegin, const int iEnd,
+                                     vector<pair<int,int> > &vDistIdx)
+{
+    const int thOrbDist = (ORBmatcher::TH_HIGH+ORBmatcher::TH_LOW)/2;
 
     // Set limits for search
     const float minZ = mb;
     const float minD = 0;
     const float maxD = mbf/minZ;
 
-    // For each left keypoint search a match in the right image
-    vector<pair<int, int> > vDistIdx;
-    vDistIdx.reserve(N);
+    vDistIdx.reserve(iEnd-iBegin);
+    vector<int> vCandidates;//right keypoints passing the level&disparity checks, their distances are computed in one batch
+    vector<int> vCandDists;
+    vCandidates.reserve(256);
+    vCandDists.reserve(256);
 
-    for(int iL=0; iL<N; iL++)
+    for(int iL=iBegin; iL<iEnd; iL++)
     {
         const cv::KeyPoint &kpL = mvKeys[iL];
         const int &levelL = kpL.octave;
         const float &vL = kpL.pt.y;
         const float &uL = kpL.pt.x;
 
-        const vector<size_t> &vCandidates = vRowIndices[vL];
+        const int *pRowBegin = vRowIndices.data()+vRowStart[(int)vL];
+        const int *pRowEnd = vRowIndices.data()+vRowStart[(int)vL+1];
 
-        if(vCandidates.empty())
+        if(pRowBegin==pRowEnd)
             continue;
 
         const float minU = uL-maxD;
@@ -715,16 +1057,10 @@ void Frame::ComputeStereoMatches()
         if(maxU<0)
             continue;
 
-        int bestDist = ORBmatcher::TH_HIGH;
-        size_t bestIdxR = 0;
-
-        const cv::Mat &dL = mDescriptors.row(iL);
-
-        // Compare descriptor to right keypoints
-        for(size_t iC=0; iC<vCandidates.size(); iC++)
+        vCandidates.clear();
+        for(const int *pIdx=pRowBegin; pIdx!=pRowEnd; pIdx++)
         {
-            const size_t iR = vCandidates[iC];
-            const cv::KeyPoint &kpR = mvKeysRight[iR];
+            const cv::KeyPoint &kpR = mvKeysRight[*pIdx];
 
             if(kpR.octave<levelL-1 || kpR.octave>levelL+1)
                 continue;
@@ -732,15 +1068,22 @@ void Frame::ComputeStereoMatches()
             const float &uR = kpR.pt.x;
 
             if(uR>=minU && uR<=maxU)
-            {
-                const cv::Mat &dR = mDescriptorsRight.row(iR);
-                const int dist = ORBmatcher::DescriptorDistance(dL,dR);
+                vCandidates.push_back(*pIdx);
+        }
+        if(vCandidates.empty())
+            continue;
 
-                if(dist<bestDist)
-                {
-                    bestDist = dist;
-                    bestIdxR = iR;
-                }
+        // Compare descriptor to right keypoints
+        ORBmatcher::DescriptorDistances(mDescriptors.row(iL),mDescriptorsRight,vCandidates,vCandDists);
+        const int nCandidates = vCandidates.size();
+        int bestDist = ORBmatcher::TH_HIGH;
+        size_t bestIdxR = 0;
+        for(int iC=0; iC<nCandidates; iC++)
+        {
+            if(vCandDists[iC]<bestDist)
+            {
+                bestDist = vCandDists[iC];
+                bestIdxR = vCandidates[iC];
             }
         }
 
@@ -756,35 +1099,27 @@ void Frame::ComputeStereoMatches()
 
             // sliding window search
             const int w = 5;
-            cv::Mat IL = mpORBextractorLeft->mvImagePyramid[kpL.octave].rowRange(scaledvL-w,scaledvL+w+1).colRange(scaleduL-w,scaleduL+w+1);
-            IL.convertTo(IL,CV_32F);
-            IL = IL - IL.at<float>(w,w) *cv::Mat::ones(IL.rows,IL.cols,CV_32F);
-
-            int bestDist = INT_MAX;
-            int bestincR = 0;
             const int L = 5;
-            vector<float> vDists;
-            vDists.resize(2*L+1);
+            const cv::Mat &imL = mpORBextractorLeft->mvImagePyramid[kpL.octave];
+            const cv::Mat &imR = mpORBextractorRight->mvImagePyramid[kpL.octave];
 
             const float iniu = scaleduR0+L-w;
             const float endu = scaleduR0+L+w+1;
-            if(iniu<0 || endu >= mpORBextractorRight->mvImagePyramid[kpL.octave].cols)
+            if(iniu<0 || endu >= imR.cols)
                 continue;
 
+            int vDists[2*L+1];
+            StereoWindowSAD(imL.ptr<uchar>(scaledvL-w)+(int)scaleduL-w,imL.step,imR.ptr<uchar>(scaledvL-w)+(int)scaleduR0-L-w,imR.step,imR.datalimit,vDists);
+
+            int bestDist = INT_MAX;
+            int bestincR = 0;
             for(int incR=-L; incR<=+L; incR++)
             {
-                cv::Mat IR = mpORBextractorRight->mvImagePyramid[kpL.octave].rowRange(scaledvL-w,scaledvL+w+1).colRange(scaleduR0+incR-w,scaleduR0+incR+w+1);
-                IR.convertTo(IR,CV_32F);
-                IR = IR - IR.at<float>(w,w) *cv::Mat::ones(IR.rows,IR.cols,CV_32F);
-
-                float dist = cv::norm(IL,IR,cv::NORM_L1);
-                if(dist<bestDist)
+                if(vDists[L+incR]<bestDist)
                 {
-                    bestDist =  dist;
+                    bestDist = vDists[L+incR];
                     bestincR = incR;
                 }
-
-                vDists[L+incR] = dist;
             }
 
             if(bestincR==-L || bestincR==L)
@@ -818,29 +1153,16 @@ void Frame::ComputeStereoMatches()
             }
         }
     }
-
-    sort(vDistIdx.begin(),vDistIdx.end());
-    const float median = vDistIdx[vDistIdx.size()/2].first;
-    const float thDist = 1.5f*1.4f*median;
-
-    for(int i=vDistIdx.size()-1;i>=0;i--)
-    {
-        if(vDistIdx[i].first<thDist)
-            break;
-        else
-        {
-            mvuRight[vDistIdx[i].second]=-1;
-            mvDepth[vDistIdx[i].second]=-1;
-        }
-    }
 }
 
 
-void Frame::ComputeStereoFromRGBD(const cv::Mat &imDepth)
+void Frame::ComputeStereoFromRGBD(const cv::Mat &imDepth, const float depthFactor)
 {
     mvuRight = vector<float>(N,-1);
     mvDepth = vector<float>(N,-1);
 
+    const bool bRaw = imDepth.type()==CV_16U;//e.g. Kinect2 in mm, not converted as a whole image
+
     for(int i=0; i<N; i++)
     {
         const cv::KeyPoint &kp = mvKeys[i];
@@ -849,7 +1171,7 @@ void Frame::ComputeStereoFromRGBD(const cv::Mat &imDepth)
         const float &v = kp.pt.y;
         const float &u = kp.pt.x;
 
-        const float d = imDepth.at<float>(v,u);
+        const float d = (bRaw ? imDepth.at<unsigned short>(v,u) : imDepth.at<float>(v,u))*depthFactor;
 
         if(d>0)
         {
@@ -66,6 +66,16 @@ void KeyFrame::UpdateNavStatePVRFromTcw()
   mNavState.setRwb(Rwb);
   mNavState.mvwb=Vw2;
 }
+void KeyFrame::SnapshotForTrack()
+{
+  mNavStateTrack=GetNavState();
+  mnTrackSnapshotId=MapPoint::nTrackSnapshotId;
+}
+NavState KeyFrame::GetNavStateTrack()
+{
+  if (mnTrackSnapshotId!=MapPoint::nTrackSnapshotId) return GetNavState();
+  return mNavStateTrack;
+}
 
 template <>//specialized
 void KeyFrame::SetPreIntegrationList<IMUData>(const listeig(IMUData)::const_iterator &begin,const listeig(IMUData)::const_iterator &pback){
@@ -96,7 +106,7 @@ std::set<KeyFrame *> KeyFrame::GetConnectedKeyFramesByWeight(int w){
 KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB,KeyFrame* pPrevKF,istream &is):
   mnFrameId(F.mnId), mTimeStamp(F.mTimeStamp), mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS),
   mfGridElementWidthInv(F.mfGridElementWidthInv), mfGridElementHeightInv(F.mfGridElementHeightInv),
-  mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0),
+  mnTrackReferenceForFrame(0), mnTrackSnapshotId(0), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0),
   mnLoopQuery(0), mnLoopWords(0), mnRelocQuery(0), mnRelocWords(0), mnBAGlobalForKF(0),
   fx(F.fx), fy(F.fy), cx(F.cx), cy(F.cy), invfx(F.invfx), invfy(F.invfy),
   mbf(F.mbf), mb(F.mb), mThDepth(F.mThDepth), N(F.N), mvKeys(F.mvKeys), mvKeysUn(F.mvKeysUn),
@@ -115,12 +125,8 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB,KeyFrame* pPrevK
   mNavState=F.mNavState;//we don't update bias for convenience in LoadMap(), though we can do it as mOdomPreIntOdom is updated in read()
   
   mnId=nNextId++;
-  mGrid.resize(mnGridCols);
-  for(int i=0; i<mnGridCols;i++){
-    mGrid[i].resize(mnGridRows);
-    for(int j=0; j<mnGridRows; j++)
-      mGrid[i][j] = F.mGrid[i][j];
-  }
+  mvGridIndices=F.mvGridIndices;
+  mvGridStart=F.mvGridStart;
   SetPose(F.mTcw);//we have already used UpdatePoseFromNS() in Frame
   
   read(is);//set odom list & mState
@@ -207,7 +213,7 @@ long unsigned int KeyFrame::nNextId=0;
 KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB,KeyFrame* pPrevKF,const char state):
     mnFrameId(F.mnId),  mTimeStamp(F.mTimeStamp), mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS),
     mfGridElementWidthInv(F.mfGridElementWidthInv), mfGridElementHeightInv(F.mfGridElementHeightInv),
-    mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0),
+    mnTrackReferenceForFrame(0), mnTrackSnapshotId(0), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0),
     mnLoopQuery(0), mnLoopWords(0), mnRelocQuery(0), mnRelocWords(0), mnBAGlobalForKF(0),
     fx(F.fx), fy(F.fy), cx(F.cx), cy(F.cy), invfx(F.invfx), invfy(F.invfy),
     mbf(F.mbf), mb(F.mb), mThDepth(F.mThDepth), N(F.N), mvKeys(F.mvKeys), mvKeysUn(F.mvKeysUn),
@@ -231,13 +237,8 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB,KeyFrame* pPrevK
   
     mnId=nNextId++;
 
-    mGrid.resize(mnGridCols);
-    for(int i=0; i<mnGridCols;i++)
-    {
-        mGrid[i].resize(mnGridRows);
-        for(int j=0; j<mnGridRows; j++)
-            mGrid[i][j] = F.mGrid[i][j];
-    }
+    mvGridIndices=F.mvGridIndices;
+    mvGridStart=F.mvGridStart;
 
     SetPose(F.mTcw);    
 }
@@ -840,6 +841,8 @@ void KeyFrame::EraseConnection(KeyFrame* pKF)
 vector<size_t> KeyFrame::GetFeaturesInArea(const float &x, const float &y, const float &r) const
 {
     vector<size_t> vIndices;
+    if(mvGridStart.empty())
+        return vIndices;
     vIndices.reserve(N);
 
     const int nMinCellX = max(0,(int)floor((x-mnMinX-r)*mfGridElementWidthInv));
@@ -860,18 +863,16 @@ vector<size_t> KeyFrame::GetFeaturesInArea(const float &x, const float &y, const
 
     for(int ix = nMinCellX; ix<=nMaxCellX; ix++)
     {
-        for(int iy = nMinCellY; iy<=nMaxCellY; iy++)
+        const int* pIdx = mvGridIndices.data() + mvGridStart[ix*mnGridRows+nMinCellY];
+        const int* pIdxEnd = mvGridIndices.data() + mvGridStart[ix*mnGridRows+nMaxCellY+1];
+        for(; pIdx!=pIdxEnd; ++pIdx)
         {
-            const vector<size_t> vCell = mGrid[ix][iy];
-            for(size_t j=0, jend=vCell.size(); j<jend; j++)
-            {
-                const cv::KeyPoint &kpUn = mvKeysUn[vCell[j]];
-                const float distx = kpUn.pt.x-x;
-                const float disty = kpUn.pt.y-y;
+            const cv::KeyPoint &kpUn = mvKeysUn[*pIdx];
+            const float distx = kpUn.pt.x-x;
+            const float disty = kpUn.pt.y-y;
 
-                if(fabs(distx)<r && fabs(disty)<r)
-                    vIndices.push_back(vCell[j]);
-            }
+            if(fabs(distx)<r && fabs(disty)<r)
+                vIndices.push_back(*pIdx);
         }
     }
 
@@ -31,7 +31,8 @@ namespace ORB_SLAM2
 LocalMapping::LocalMapping(Map *pMap, const bool bMonocular,const string &strSettingPath):
     mbMonocular(bMonocular), mbResetRequested(false), mbFinishRequested(false), mbFinished(true), mpMap(pMap),
     mbAbortBA(false), mbStopped(false), mbStopRequested(false), mbNotStop(false), mbAcceptKeyFrames(true),
-    mnLastOdomKFId(0),mpLastCamKF(NULL)//added by zzh
+    mnLastOdomKFId(0),mpLastCamKF(NULL),//added by zzh
+    mpWorkerPool(NULL)
 {//zzh
   cv::FileStorage fSettings(strSettingPath,cv::FileStorage::READ);
   cv::FileNode fnSize=fSettings["LocalMapping.LocalWindowSize"];
@@ -41,7 +42,9 @@ LocalMapping::LocalMapping(Map *pMap, const bool bMonocular,const string &strSet
   }else{
     mnLocalWindowSize=fnSize;//notice it can <1
   }
-  
+  cv::FileNode fnThreads=fSettings["LocalMapping.nThreads"];//optional, number of neighbor KFs triangulated concurrently
+  int nThreads=fnThreads.empty()?1:(int)fnThreads;
+  mpWorkerPool=nThreads>1?new WorkerPool(nThreads-1):static_cast<WorkerPool*>(NULL);//the LocalMapping thread itself is one of them
 }
 
 void LocalMapping::SetLoopCloser(LoopClosing* pLoopCloser)
@@ -293,7 +296,47 @@ void LocalMapping::CreateNewMapPoints()
     if(mbMonocular)
         nn=20;
     const vector<KeyFrame*> vpNeighKFs = mpCurrentKeyFrame->GetBestCovisibilityKeyFrames(nn);
+    const size_t N=vpNeighKFs.size();
+    vector<vector<TriangulatedMatch> > vvTriangulated(N);
 
+    if(!mpWorkerPool||N<2)
+    {
+        for(size_t i=0; i<N; i++)
+        {
+            if(i>0 && CheckNewKeyFrames())//if it's busy then just triangulate the best covisible KF
+                return;
+            TriangulateNeighbor(vpNeighKFs[i],vvTriangulated[i]);
+            AddTriangulatedMapPoints(vpNeighKFs[i],vvTriangulated[i]);
+        }
+        return;
+    }
+
+    // Search matches with epipolar restriction and triangulate, each neighbor in its own task;
+    // only reads the KFs, so the MapPoints are created afterwards in the covisibility order
+    vector<char> vbAborted(N,0);
+    vector<future<void> > vFutures;
+    vFutures.reserve(N-1);
+    for(size_t i=1; i<N; i++)
+        vFutures.push_back(mpWorkerPool->Submit([this,i,&vpNeighKFs,&vvTriangulated,&vbAborted]{
+            if(CheckNewKeyFrames())//if it's busy then just triangulate the best covisible KF
+                vbAborted[i]=1;
+            else
+                TriangulateNeighbor(vpNeighKFs[i],vvTriangulated[i]);
+        }));
+    TriangulateNeighbor(vpNeighKFs[0],vvTriangulated[0]);
+    for(size_t i=0; i<vFutures.size(); i++)
+        mpWorkerPool->Wait(vFutures[i]);
+
+    for(size_t i=0; i<N; i++)
+    {
+        if(vbAborted[i])
+            return;
+        AddTriangulatedMapPoints(vpNeighKFs[i],vvTriangulated[i]);
+    }
+}
+
+void LocalMapping::TriangulateNeighbor(KeyFrame* pKF2,vector<TriangulatedMatch> &vTriangulated)
+{
     ORBmatcher matcher(0.6,false);
 
     cv::Mat Rcw1 = mpCurrentKeyFrame->GetRotation();
@@ -313,230 +356,235 @@ void LocalMapping::CreateNewMapPoints()
 
     const float ratioFactor = 1.5f*mpCurrentKeyFrame->mfScaleFactor;//1.5*1.2=1.8
 
-    int nnew=0;//unused here
+    // Check first that baseline is not too short
+    cv::Mat Ow2 = pKF2->GetCameraCenter();
+    cv::Mat vBaseline = Ow2-Ow1;
+    const float baseline = cv::norm(vBaseline);
 
-    // Search matches with epipolar restriction and triangulate
-    for(size_t i=0; i<vpNeighKFs.size(); i++)
+    if(!mbMonocular)
     {
-        if(i>0 && CheckNewKeyFrames())//if it's busy then just triangulate the best covisible KF
+        if(baseline<pKF2->mb)//for RGBD, if moved distance < mb(equivalent baseline), it's not wise to process maybe for it cannot see farther than depth camera
             return;
+    }
+    else
+    {
+        const float medianDepthKF2 = pKF2->ComputeSceneMedianDepth(2);
+        const float ratioBaselineDepth = baseline/medianDepthKF2;
 
-        KeyFrame* pKF2 = vpNeighKFs[i];
-
-        // Check first that baseline is not too short
-        cv::Mat Ow2 = pKF2->GetCameraCenter();
-        cv::Mat vBaseline = Ow2-Ow1;
-        const float baseline = cv::norm(vBaseline);
-
-        if(!mbMonocular)
-        {
-            if(baseline<pKF2->mb)//for RGBD, if moved distance < mb(equivalent baseline), it's not wise to process maybe for it cannot see farther than depth camera
-            continue;
-        }
-        else
-        {
-            const float medianDepthKF2 = pKF2->ComputeSceneMedianDepth(2);
-            const float ratioBaselineDepth = baseline/medianDepthKF2;
-
-            if(ratioBaselineDepth<0.01)//at least baseline>=0.08m/8m(medianDepth)
-                continue;
-        }
+        if(ratioBaselineDepth<0.01)//at least baseline>=0.08m/8m(medianDepth)
+            return;
+    }
 
-        // Compute Fundamental Matrix
-        cv::Mat F12 = ComputeF12(mpCurrentKeyFrame,pKF2);
-
-        // Search matches that fullfil epipolar constraint(with 2 sigma rule)
-        vector<pair<size_t,size_t> > vMatchedIndices;
-        matcher.SearchForTriangulation(mpCurrentKeyFrame,pKF2,F12,vMatchedIndices,false);//matching method is like SBBoW
-
-        cv::Mat Rcw2 = pKF2->GetRotation();
-        cv::Mat Rwc2 = Rcw2.t();
-        cv::Mat tcw2 = pKF2->GetTranslation();
-        cv::Mat Tcw2(3,4,CV_32F);
-        Rcw2.copyTo(Tcw2.colRange(0,3));
-        tcw2.copyTo(Tcw2.col(3));
-
-        const float &fx2 = pKF2->fx;
-        const float &fy2 = pKF2->fy;
-        const float &cx2 = pKF2->cx;
-        const float &cy2 = pKF2->cy;
-        const float &invfx2 = pKF2->invfx;
-        const float &invfy2 = pKF2->invfy;
-
-        // Triangulate each match
-        const int nmatches = vMatchedIndices.size();
-        for(int ikp=0; ikp<nmatches; ikp++)
-        {
-            const int &idx1 = vMatchedIndices[ikp].first;
-            const int &idx2 = vMatchedIndices[ikp].second;
+    // Compute Fundamental Matrix
+    cv::Mat F12 = ComputeF12(mpCurrentKeyFrame,pKF2);
+
+    // Search matches that fullfil epipolar constraint(with 2 sigma rule)
+    vector<pair<size_t,size_t> > vMatchedIndices;
+    matcher.SearchForTriangulation(mpCurrentKeyFrame,pKF2,F12,vMatchedIndices,false);//matching method is like SBBoW
+
+    cv::Mat Rcw2 = pKF2->GetRotation();
+    cv::Mat Rwc2 = Rcw2.t();
+    cv::Mat tcw2 = pKF2->GetTranslation();
+    cv::Mat Tcw2(3,4,CV_32F);
+    Rcw2.copyTo(Tcw2.colRange(0,3));
+    tcw2.copyTo(Tcw2.col(3));
+
+    const float &fx2 = pKF2->fx;
+    const float &fy2 = pKF2->fy;
+    const float &cx2 = pKF2->cx;
+    const float &cy2 = pKF2->cy;
+    const float &invfx2 = pKF2->invfx;
+    const float &invfy2 = pKF2->invfy;
+
+    // Triangulate each match
+    const int nmatches = vMatchedIndices.size();
+    for(int ikp=0; ikp<nmatches; ikp++)
+    {
+        const int &idx1 = vMatchedIndices[ikp].first;
+        const int &idx2 = vMatchedIndices[ikp].second;
 
-            const cv::KeyPoint &kp1 = mpCurrentKeyFrame->mvKeysUn[idx1];
-            const float kp1_ur=mpCurrentKeyFrame->mvuRight[idx1];
-            bool bStereo1 = kp1_ur>=0;
+        const cv::KeyPoint &kp1 = mpCurrentKeyFrame->mvKeysUn[idx1];
+        const float kp1_ur=mpCurrentKeyFrame->mvuRight[idx1];
+        bool bStereo1 = kp1_ur>=0;
 
-            const cv::KeyPoint &kp2 = pKF2->mvKeysUn[idx2];
-            const float kp2_ur = pKF2->mvuRight[idx2];
-            bool bStereo2 = kp2_ur>=0;
+        const cv::KeyPoint &kp2 = pKF2->mvKeysUn[idx2];
+        const float kp2_ur = pKF2->mvuRight[idx2];
+        bool bStereo2 = kp2_ur>=0;
 
-            // Check parallax between rays
-            cv::Mat xn1 = (cv::Mat_<float>(3,1) << (kp1.pt.x-cx1)*invfx1, (kp1.pt.y-cy1)*invfy1, 1.0);//(x'1/z'2,y'2/z'2,1)
-            cv::Mat xn2 = (cv::Mat_<float>(3,1) << (kp2.pt.x-cx2)*invfx2, (kp2.pt.y-cy2)*invfy2, 1.0);//(x'2/z'2,y'2/z'2,1)
+        // Check parallax between rays
+        cv::Mat xn1 = (cv::Mat_<float>(3,1) << (kp1.pt.x-cx1)*invfx1, (kp1.pt.y-cy1)*invfy1, 1.0);//(x'1/z'2,y'2/z'2,1)
+        cv::Mat xn2 = (cv::Mat_<float>(3,1) << (kp2.pt.x-cx2)*invfx2, (kp2.pt.y-cy2)*invfy2, 1.0);//(x'2/z'2,y'2/z'2,1)
 
-            cv::Mat ray1 = Rwc1*xn1;
-            cv::Mat ray2 = Rwc2*xn2;
-            const float cosParallaxRays = ray1.dot(ray2)/(cv::norm(ray1)*cv::norm(ray2));//the Rays parallax angle must be in [0,180) for depth >0
+        cv::Mat ray1 = Rwc1*xn1;
+        cv::Mat ray2 = Rwc2*xn2;
+        const float cosParallaxRays = ray1.dot(ray2)/(cv::norm(ray1)*cv::norm(ray2));//the Rays parallax angle must be in [0,180) for depth >0
 
-            float cosParallaxStereo = cosParallaxRays+1;//+1 && cosParallaxRays>0 -> always choosing stereo parallax(if exists) cos value as the cosParallaxStereo
-            float cosParallaxStereo1 = cosParallaxStereo;
-            float cosParallaxStereo2 = cosParallaxStereo;
+        float cosParallaxStereo = cosParallaxRays+1;//+1 && cosParallaxRays>0 -> always choosing stereo parallax(if exists) cos value as the cosParallaxStereo
+        float cosParallaxStereo1 = cosParallaxStereo;
+        float cosParallaxStereo2 = cosParallaxStereo;
 
-            if(bStereo1)
-                cosParallaxStereo1 = cos(2*atan2(mpCurrentKeyFrame->mb/2,mpCurrentKeyFrame->mvDepth[idx1]));
-            else if(bStereo2)//maybe here can be improved
-                cosParallaxStereo2 = cos(2*atan2(pKF2->mb/2,pKF2->mvDepth[idx2]));//this cos value is the min stereo parallax value
+        if(bStereo1)
+            cosParallaxStereo1 = cos(2*atan2(mpCurrentKeyFrame->mb/2,mpCurrentKeyFrame->mvDepth[idx1]));
+        else if(bStereo2)//maybe here can be improved
+            cosParallaxStereo2 = cos(2*atan2(pKF2->mb/2,pKF2->mvDepth[idx2]));//this cos value is the min stereo parallax value
 		//(the point with certain depth has max stereo parallax angle when its Xc is at the centre of baseline), here stereo parallax!=Rays parallax
 
-            cosParallaxStereo = min(cosParallaxStereo1,cosParallaxStereo2);
+        cosParallaxStereo = min(cosParallaxStereo1,cosParallaxStereo2);
 
 	    //use triangulation method when it's 2 monocular points with enough parallax or at least 1 stereo point with less accuracy in depth data
-            cv::Mat x3D;
+        cv::Mat x3D;
 	    //if >=1 stereo point -> if Rays parallax angle is >= angleParallaxStereo1(!bStereo1->2)(will get better x3D result) && its Rays parallax angle <90 degrees(over will make 1st condition some problem && make feature matching unreliable?)
-            if(cosParallaxRays<cosParallaxStereo && cosParallaxRays>0 && (bStereo1 || bStereo2 || cosParallaxRays<0.9998))//if both monocular then parallax angle must be in [1.15,90) degrees
-            {
-                // Linear Triangulation Method, though it's not the best method
-                cv::Mat A(4,4,CV_32F);//Xc=K^(-1)*P=[Rcw|tcw]*Xw;(Xc*1-[Rcw|tcw]*Xw)(0:1),1=([Rcw|tcw]*Xw)(2)=Tcw.row(2)
-                //=>A=[Xc1(0)*Tc1w.row(2)-Tc1w.row(0);Xc1(1)*Tc1w.row(2)-Tc1w.row(1);Xc2(0)*Tc2w.row(2)-Tc2w.row(0);Xc2(1)*Tc2w.row(2)-Tc2w.row(1)]=4*4 matrix,
-                //AX=0, see http://www.robots.ox.ac.uk/~az/tutorials/tutoriala.pdf
-                A.row(0) = xn1.at<float>(0)*Tcw1.row(2)-Tcw1.row(0);
-                A.row(1) = xn1.at<float>(1)*Tcw1.row(2)-Tcw1.row(1);
-                A.row(2) = xn2.at<float>(0)*Tcw2.row(2)-Tcw2.row(0);
-                A.row(3) = xn2.at<float>(1)*Tcw2.row(2)-Tcw2.row(1);
+        if(cosParallaxRays<cosParallaxStereo && cosParallaxRays>0 && (bStereo1 || bStereo2 || cosParallaxRays<0.9998))//if both monocular then parallax angle must be in [1.15,90) degrees
+        {
+            // Linear Triangulation Method, though it's not the best method
+            cv::Mat A(4,4,CV_32F);//Xc=K^(-1)*P=[Rcw|tcw]*Xw;(Xc*1-[Rcw|tcw]*Xw)(0:1),1=([Rcw|tcw]*Xw)(2)=Tcw.row(2)
+            //=>A=[Xc1(0)*Tc1w.row(2)-Tc1w.row(0);Xc1(1)*Tc1w.row(2)-Tc1w.row(1);Xc2(0)*Tc2w.row(2)-Tc2w.row(0);Xc2(1)*Tc2w.row(2)-Tc2w.row(1)]=4*4 matrix,
+            //AX=0, see http://www.robots.ox.ac.uk/~az/tutorials/tutoriala.pdf
+            A.row(0) = xn1.at<float>(0)*Tcw1.row(2)-Tcw1.row(0);
+            A.row(1) = xn1.at<float>(1)*Tcw1.row(2)-Tcw1.row(1);
+            A.row(2) = xn2.at<float>(0)*Tcw2.row(2)-Tcw2.row(0);
+            A.row(3) = xn2.at<float>(1)*Tcw2.row(2)-Tcw2.row(1);
 
 		//min(X) ||AX||^2 s.t. ||x||=1 should use SVD method, see  http://blog.csdn.net/zhyh1435589631/article/details/62218421
-                cv::Mat w,u,vt;
-                cv::SVD::compute(A,w,u,vt,cv::SVD::MODIFY_A| cv::SVD::FULL_UV);
+            cv::Mat w,u,vt;
+            cv::SVD::compute(A,w,u,vt,cv::SVD::MODIFY_A| cv::SVD::FULL_UV);
 
-                x3D = vt.row(3).t();//get the min eigen/singular value's corresponding eigen vector v.col(3)
+            x3D = vt.row(3).t();//get the min eigen/singular value's corresponding eigen vector v.col(3)
 
-                if(x3D.at<float>(3)==0)//cannot be SVD decomposed
-                    continue;
+            if(x3D.at<float>(3)==0)//cannot be SVD decomposed
+                continue;
 
-                // Euclidean coordinates
-                x3D = x3D.rowRange(0,3)/x3D.at<float>(3);
+            // Euclidean coordinates
+            x3D = x3D.rowRange(0,3)/x3D.at<float>(3);
 
-            }
-            else if(bStereo1 && cosParallaxStereo1<cosParallaxStereo2)//when 1st condition true then 2nd condition is false can only happen when cosParallaxRays<=0
-            {
-                x3D = mpCurrentKeyFrame->UnprojectStereo(idx1);                
-            }
-            else if(bStereo2 && cosParallaxStereo2<cosParallaxStereo1)
-            {
-                x3D = pKF2->UnprojectStereo(idx2);
-            }
-            else
-                continue; //No stereo and very low(or >=90 degrees) parallax, but here sometimes may introduce Rays parallax angle>=90 degrees with >=1 stereo point
+        }
+        else if(bStereo1 && cosParallaxStereo1<cosParallaxStereo2)//when 1st condition true then 2nd condition is false can only happen when cosParallaxRays<=0
+        {
+            x3D = mpCurrentKeyFrame->UnprojectStereo(idx1);                
+        }
+        else if(bStereo2 && cosParallaxStereo2<cosParallaxStereo1)
+        {
+            x3D = pKF2->UnprojectStereo(idx2);
+        }
+        else
+            continue; //No stereo and very low(or >=90 degrees) parallax, but here sometimes may introduce Rays parallax angle>=90 degrees with >=1 stereo point
 
-            cv::Mat x3Dt = x3D.t();
+        cv::Mat x3Dt = x3D.t();
 
-            //Check triangulation in front of cameras, depth must be >0
-            float z1 = Rcw1.row(2).dot(x3Dt)+tcw1.at<float>(2);//zc=Xc(2)=[Rcw|tcw](2)*Xw
-            if(z1<=0)
-                continue;
+        //Check triangulation in front of cameras, depth must be >0
+        float z1 = Rcw1.row(2).dot(x3Dt)+tcw1.at<float>(2);//zc=Xc(2)=[Rcw|tcw](2)*Xw
+        if(z1<=0)
+            continue;
 
-            float z2 = Rcw2.row(2).dot(x3Dt)+tcw2.at<float>(2);
-            if(z2<=0)
-                continue;
+        float z2 = Rcw2.row(2).dot(x3Dt)+tcw2.at<float>(2);
+        if(z2<=0)
+            continue;
 
-            //Check reprojection error in first keyframe by chi2 distribution
-            const float &sigmaSquare1 = mpCurrentKeyFrame->mvLevelSigma2[kp1.octave];
-            const float x1 = Rcw1.row(0).dot(x3Dt)+tcw1.at<float>(0);//xc1
-            const float y1 = Rcw1.row(1).dot(x3Dt)+tcw1.at<float>(1);//yc1
-            const float invz1 = 1.0/z1;
+        //Check reprojection error in first keyframe by chi2 distribution
+        const float &sigmaSquare1 = mpCurrentKeyFrame->mvLevelSigma2[kp1.octave];
+        const float x1 = Rcw1.row(0).dot(x3Dt)+tcw1.at<float>(0);//xc1
+        const float y1 = Rcw1.row(1).dot(x3Dt)+tcw1.at<float>(1);//yc1
+        const float invz1 = 1.0/z1;
 
-            if(!bStereo1)
-            {
-                float u1 = fx1*x1*invz1+cx1;
-                float v1 = fy1*y1*invz1+cy1;
-                float errX1 = u1 - kp1.pt.x;
-                float errY1 = v1 - kp1.pt.y;
+        if(!bStereo1)
+        {
+            float u1 = fx1*x1*invz1+cx1;
+            float v1 = fy1*y1*invz1+cy1;
+            float errX1 = u1 - kp1.pt.x;
+            float errY1 = v1 - kp1.pt.y;
 		//(e^2-0^2)/sigma^2 (if sigma&&0 is population supposed variance&&expected value not sample parameters then degree of freedom is n not n-1)
-                if((errX1*errX1+errY1*errY1)>5.991*sigmaSquare1)//if e'*[1/sigma^2 0;0 1/sigma^2](/Omiga)*e>chi2(0.05 significance level,2 degrees of freedom), it's wrong(95% judgement is right)
-                    continue;
-            }
-            else
-            {
-                float u1 = fx1*x1*invz1+cx1;
-                float u1_r = u1 - mpCurrentKeyFrame->mbf*invz1;
-                float v1 = fy1*y1*invz1+cy1;
-                float errX1 = u1 - kp1.pt.x;
-                float errY1 = v1 - kp1.pt.y;
-                float errX1_r = u1_r - kp1_ur;
-                if((errX1*errX1+errY1*errY1+errX1_r*errX1_r)>7.8*sigmaSquare1)//chi2(0.05,3)
-                    continue;
-            }
+            if((errX1*errX1+errY1*errY1)>5.991*sigmaSquare1)//if e'*[1/sigma^2 0;0 1/sigma^2](/Omiga)*e>chi2(0.05 significance level,2 degrees of freedom), it's wrong(95% judgement is right)
+                continue;
+        }
+        else
+        {
+            float u1 = fx1*x1*invz1+cx1;
+            float u1_r = u1 - mpCurrentKeyFrame->mbf*invz1;
+            float v1 = fy1*y1*invz1+cy1;
+            float errX1 = u1 - kp1.pt.x;
+            float errY1 = v1 - kp1.pt.y;
+            float errX1_r = u1_r - kp1_ur;
+            if((errX1*errX1+errY1*errY1+errX1_r*errX1_r)>7.8*sigmaSquare1)//chi2(0.05,3)
+                continue;
+        }
 
-            //Check reprojection error in second keyframe
-            const float sigmaSquare2 = pKF2->mvLevelSigma2[kp2.octave];
-            const float x2 = Rcw2.row(0).dot(x3Dt)+tcw2.at<float>(0);
-            const float y2 = Rcw2.row(1).dot(x3Dt)+tcw2.at<float>(1);
-            const float invz2 = 1.0/z2;
-            if(!bStereo2)
-            {
-                float u2 = fx2*x2*invz2+cx2;
-                float v2 = fy2*y2*invz2+cy2;
-                float errX2 = u2 - kp2.pt.x;
-                float errY2 = v2 - kp2.pt.y;
-                if((errX2*errX2+errY2*errY2)>5.991*sigmaSquare2)//chi2(0.05,2)
-                    continue;
-            }
-            else
-            {
-                float u2 = fx2*x2*invz2+cx2;
-                float u2_r = u2 - mpCurrentKeyFrame->mbf*invz2;
-                float v2 = fy2*y2*invz2+cy2;
-                float errX2 = u2 - kp2.pt.x;
-                float errY2 = v2 - kp2.pt.y;
-                float errX2_r = u2_r - kp2_ur;
-                if((errX2*errX2+errY2*errY2+errX2_r*errX2_r)>7.8*sigmaSquare2)//chi2(0.05,3)
-                    continue;
-            }
+        //Check reprojection error in second keyframe
+        const float sigmaSquare2 = pKF2->mvLevelSigma2[kp2.octave];
+        const float x2 = Rcw2.row(0).dot(x3Dt)+tcw2.at<float>(0);
+        const float y2 = Rcw2.row(1).dot(x3Dt)+tcw2.at<float>(1);
+        const float invz2 = 1.0/z2;
+        if(!bStereo2)
+        {
+            float u2 = fx2*x2*invz2+cx2;
+            float v2 = fy2*y2*invz2+cy2;
+            float errX2 = u2 - kp2.pt.x;
+            float errY2 = v2 - kp2.pt.y;
+            if((errX2*errX2+errY2*errY2)>5.991*sigmaSquare2)//chi2(0.05,2)
+                continue;
+        }
+        else
+        {
+            float u2 = fx2*x2*invz2+cx2;
+            float u2_r = u2 - mpCurrentKeyFrame->mbf*invz2;
+            float v2 = fy2*y2*invz2+cy2;
+            float errX2 = u2 - kp2.pt.x;
+            float errY2 = v2 - kp2.pt.y;
+            float errX2_r = u2_r - kp2_ur;
+            if((errX2*errX2+errY2*errY2+errX2_r*errX2_r)>7.8*sigmaSquare2)//chi2(0.05,3)
+                continue;
+        }
 
-            //Check scale consistency, is this dist not depth very good?
-            cv::Mat normal1 = x3D-Ow1;
-            float dist1 = cv::norm(normal1);
+        //Check scale consistency, is this dist not depth very good?
+        cv::Mat normal1 = x3D-Ow1;
+        float dist1 = cv::norm(normal1);
 
-            cv::Mat normal2 = x3D-Ow2;
-            float dist2 = cv::norm(normal2);
+        cv::Mat normal2 = x3D-Ow2;
+        float dist2 = cv::norm(normal2);
 
-            if(dist1==0 || dist2==0)//it seems impossible for zi>0, if possible it maybe numerical error
-                continue;
+        if(dist1==0 || dist2==0)//it seems impossible for zi>0, if possible it maybe numerical error
+            continue;
 
-            const float ratioDist = dist2/dist1;
-            const float ratioOctave = mpCurrentKeyFrame->mvScaleFactors[kp1.octave]/pKF2->mvScaleFactors[kp2.octave];
+        const float ratioDist = dist2/dist1;
+        const float ratioOctave = mpCurrentKeyFrame->mvScaleFactors[kp1.octave]/pKF2->mvScaleFactors[kp2.octave];
 
-            /*if(fabs(ratioDist-ratioOctave)>ratioFactor)
-                continue;*/
-            if(ratioDist*ratioFactor<ratioOctave || ratioDist>ratioOctave*ratioFactor)//ratioOctave must be in [ratioDist/ratioFactor,ratioDist*ratioFactor], notice ratioFactor is 1.5*mpCurrentKeyFrame->mfScaleFactor
-                continue;
+        /*if(fabs(ratioDist-ratioOctave)>ratioFactor)
+            continue;*/
+        if(ratioDist*ratioFactor<ratioOctave || ratioDist>ratioOctave*ratioFactor)//ratioOctave must be in [ratioDist/ratioFactor,ratioDist*ratioFactor], notice ratioFactor is 1.5*mpCurrentKeyFrame->mfScaleFactor
+            continue;
+
+        // Triangulation is succesfull
+        TriangulatedMatch tm;
+        tm.idx1=idx1;
+        tm.idx2=idx2;
+        tm.x3D=x3D;
+        vTriangulated.push_back(tm);
+    }
+}
 
-            // Triangulation is succesfull
-            MapPoint* pMP = new MapPoint(x3D,mpCurrentKeyFrame,mpMap);//notice pMp->mnFirstKFid=mpCurrentKeyFrame->mnID
+void LocalMapping::AddTriangulatedMapPoints(KeyFrame* pKF2,const vector<TriangulatedMatch> &vTriangulated)
+{
+    for(size_t i=0; i<vTriangulated.size(); i++)
+    {
+        const size_t &idx1=vTriangulated[i].idx1;
+        const size_t &idx2=vTriangulated[i].idx2;
+        //a former neighbor may have triangulated the same keypoint of mpCurrentKeyFrame
+        if(mpCurrentKeyFrame->GetMapPoint(idx1) || pKF2->GetMapPoint(idx2))
+            continue;
 
-            pMP->AddObservation(mpCurrentKeyFrame,idx1);            
-            pMP->AddObservation(pKF2,idx2);
+        MapPoint* pMP = new MapPoint(vTriangulated[i].x3D,mpCurrentKeyFrame,mpMap);//notice pMp->mnFirstKFid=mpCurrentKeyFrame->mnID
 
-            mpCurrentKeyFrame->AddMapPoint(pMP,idx1);
-            pKF2->AddMapPoint(pMP,idx2);
+        pMP->AddObservation(mpCurrentKeyFrame,idx1);            
+        pMP->AddObservation(pKF2,idx2);
 
-            pMP->ComputeDistinctiveDescriptors();
+        mpCurrentKeyFrame->AddMapPoint(pMP,idx1);
+        pKF2->AddMapPoint(pMP,idx2);
 
-            pMP->UpdateNormalAndDepth();
+        pMP->ComputeDistinctiveDescriptors();
 
-            mpMap->AddMapPoint(pMP);
-            mlpRecentAddedMapPoints.push_back(pMP);
+        pMP->UpdateNormalAndDepth();
 
-            nnew++;
-        }
+        mpMap->AddMapPoint(pMP);
+        mlpRecentAddedMapPoints.push_back(pMP);
     }
 }
 
@@ -600,6 +600,7 @@ void LoopClosing::CorrectLoop()
             }
         }
 	mpMap->InformNewChange();//improved by zzh
+	mpMap->InformPoseJump();//the local map of Tracking is corrected here, before InformNewBigChange()
     }
 
     // Project MapPoints observed in the neighborhood of the loop keyframe
@@ -837,6 +838,7 @@ void LoopClosing::RunGlobalBundleAdjustment(unsigned long nLoopKF)//nLoopKF here
             }            
 
             mpMap->InformNewBigChange();//used to check the SLAM's state
+            mpMap->InformPoseJump();
 
             mpLocalMapper->Release();//recover LocalMapping thread, same as CorrectLoop()
             
@@ -48,7 +48,7 @@ void Map::clearMPs(){
 //created by zzh over
 
 Map::Map():mnMaxKFid(0),mnBigChangeIdx(0),
-mnChangeIdx(0)//zzh
+mnChangeIdx(0),mdScaleChange(1),mnPoseJumpIdx(0)//zzh
 {
 }
 
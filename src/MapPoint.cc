@@ -36,7 +36,7 @@ void MapPoint::UpdateScale(const float &scale){
 //for Load/SaveMap()
 MapPoint::MapPoint(KeyFrame *pRefKF, Map* pMap,istream &is):
     mnFirstKFid(pRefKF->mnId), mnFirstFrame(pRefKF->mnFrameId), nObs(0), mnTrackReferenceForFrame(0),
-    mnLastFrameSeen(0), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
+    mnLastFrameSeen(0), mnTrackSnapshotId(0), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
     mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(pRefKF), mnVisible(1), mnFound(1), mbBad(false),//mnVisible&mnFound will be set by TrackLocalMap() in Tracking.cc, used in LocalMapping.cc
     mpReplaced(static_cast<MapPoint*>(NULL)), mfMinDistance(0), mfMaxDistance(0), mpMap(pMap)
 {
@@ -64,11 +64,12 @@ bool MapPoint::write(ostream &os){
 //added by zzh
   
 long unsigned int MapPoint::nNextId=0;
+long unsigned int MapPoint::nTrackSnapshotId=0;
 mutex MapPoint::mGlobalMutex;
 
 MapPoint::MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map* pMap):
     mnFirstKFid(pRefKF->mnId), mnFirstFrame(pRefKF->mnFrameId), nObs(0), mnTrackReferenceForFrame(0),
-    mnLastFrameSeen(0), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
+    mnLastFrameSeen(0), mnTrackSnapshotId(0), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
     mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(pRefKF), mnVisible(1), mnFound(1), mbBad(false),
     mpReplaced(static_cast<MapPoint*>(NULL)), mfMinDistance(0), mfMaxDistance(0), mpMap(pMap)
 {
@@ -81,7 +82,7 @@ MapPoint::MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map* pMap):
 }
 
 MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF):
-    mnFirstKFid(-1), mnFirstFrame(pFrame->mnId), nObs(0), mnTrackReferenceForFrame(0), mnLastFrameSeen(0),
+    mnFirstKFid(-1), mnFirstFrame(pFrame->mnId), nObs(0), mnTrackReferenceForFrame(0), mnLastFrameSeen(0), mnTrackSnapshotId(0),
     mnBALocalForKF(0), mnFuseCandidateForKF(0),mnLoopPointForKF(0), mnCorrectedByKF(0),
     mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(static_cast<KeyFrame*>(NULL)), mnVisible(1),
     mnFound(1), mbBad(false), mpReplaced(NULL), mpMap(pMap)
@@ -309,12 +310,18 @@ void MapPoint::ComputeDistinctiveDescriptors()
     const size_t N = vDescriptors.size();
 
     float Distances[N][N];
+    vector<const uchar*> vpDescriptors(N);
+    for(size_t i=0;i<N;i++)
+        vpDescriptors[i]=vDescriptors[i].ptr<uchar>();
+    vector<int> vDistsi(N);
     for(size_t i=0;i<N;i++)
     {
         Distances[i][i]=0;
+        if(i+1<N)//the hamming distances of the 256 bit descriptor i to all the later ones at once
+            ORBmatcher::DescriptorDistances(vDescriptors[i],&vpDescriptors[i+1],N-i-1,&vDistsi[i+1]);
         for(size_t j=i+1;j<N;j++)
         {
-            int distij = ORBmatcher::DescriptorDistance(vDescriptors[i],vDescriptors[j]);//the hamming distance of the 256 bit descriptor(at the fastest way)
+            int distij = vDistsi[j];
             Distances[i][j]=distij;
             Distances[j][i]=distij;
         }
@@ -406,6 +413,39 @@ void MapPoint::UpdateNormalAndDepth()
     }
 }
 
+void MapPoint::GetFrustumData(float* pos, float* normal, float &minDistance, float &maxDistance)
+{
+    unique_lock<mutex> lock(mMutexPos);
+    for(int i=0; i<3; i++)
+    {
+        pos[i] = mWorldPos.at<float>(i);
+        normal[i] = mNormalVector.at<float>(i);
+    }
+    minDistance = mfMinDistance;
+    maxDistance = mfMaxDistance;
+}
+void MapPoint::SnapshotForTrack()
+{
+    GetFrustumData(mTrackSnapPos,mTrackSnapNormal,mfTrackSnapMinDist,mfTrackSnapMaxDist);
+    mnTrackSnapshotId=nTrackSnapshotId;
+}
+cv::Mat MapPoint::GetWorldPosTrack()
+{
+    if (mnTrackSnapshotId!=nTrackSnapshotId) return GetWorldPos();
+    return cv::Mat(3,1,CV_32F,mTrackSnapPos).clone();
+}
+void MapPoint::GetFrustumDataTrack(float* pos, float* normal, float &minDistance, float &maxDistance)
+{
+    if (mnTrackSnapshotId!=nTrackSnapshotId) return GetFrustumData(pos,normal,minDistance,maxDistance);
+    for(int i=0; i<3; i++)
+    {
+        pos[i] = mTrackSnapPos[i];
+        normal[i] = mTrackSnapNormal[i];
+    }
+    minDistance = mfTrackSnapMinDist;
+    maxDistance = mfTrackSnapMaxDist;
+}
+
 float MapPoint::GetMinDistanceInvariance()
 {
     unique_lock<mutex> lock(mMutexPos);
@@ -59,6 +59,10 @@
 #include <opencv2/features2d/features2d.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <vector>
+#include <thread>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include "ORBextractor.h"
 
@@ -105,45 +109,69 @@ static float IC_Angle(const Mat& image, Point2f pt,  const vector<int> & u_max)/
 
 
 const float factorPI = (float)(CV_PI/180.f);
-static void computeOrbDescriptor(const KeyPoint& kpt,
-                                 const Mat& img, const Point* pattern,
-                                 uchar* desc)
+const int ANGLE_BINS = 30;//the rotated patterns are precomputed for 12 degree steps like the original ORB
+
+static void makeRotatedPatterns(const vector<Point>& pattern, vector<Point>& rotatedPatterns)//rotatedPatterns[bin*512+i] is pattern[i] rotated by bin*360/ANGLE_BINS degrees
 {
-    float angle = (float)kpt.angle*factorPI;
-    float a = (float)cos(angle), b = (float)sin(angle);
+    const int npoints = (int)pattern.size();
+    rotatedPatterns.resize(ANGLE_BINS*npoints);
+    for (int bin = 0; bin < ANGLE_BINS; ++bin)
+    {
+        float angle = bin*(360.f/ANGLE_BINS)*factorPI;
+        float a = (float)cos(angle), b = (float)sin(angle);
+        //notice this is the rotation matrix from frame IC to frame fixed,or the -theta of coordinate rotation matrix;Rfix_IC=[[cos(-th) sin(-th)][-sin(-th) cos(-th)]]
+        for (int i = 0; i < npoints; ++i)
+            rotatedPatterns[bin*npoints+i] = Point(cvRound(pattern[i].x*a - pattern[i].y*b), cvRound(pattern[i].x*b + pattern[i].y*a));
+    }
+}
 
-    const uchar* center = &img.at<uchar>(cvRound(kpt.pt.y), cvRound(kpt.pt.x));
-    const int step = (int)img.step;
+static void makePatternOffsets(const vector<Point>& rotatedPatterns, int step, vector<int>& offsets)//byte offsets of the rotated patterns in an image with this step
+{
+    offsets.resize(rotatedPatterns.size());
+    for (size_t i = 0; i < rotatedPatterns.size(); ++i)
+        offsets[i] = rotatedPatterns[i].y*step + rotatedPatterns[i].x;
+}
 
-    #define GET_VALUE(idx) \
-        center[cvRound(pattern[idx].x*b + pattern[idx].y*a)*step + \
-               cvRound(pattern[idx].x*a - pattern[idx].y*b)]
-    //notice this is the rotation matrix from frame IC to frame fixed,or the -theta of coordinate rotation matrix;Rfix_IC=[[cos(-th) sin(-th)][-sin(-th) cos(-th)]]
+//ofs is the 512 offsets of the rotated pattern of kpt.angle's bin; bit j of the descriptor is 1 when p(2j)<p(2j+1)
+static void computeOrbDescriptor(const KeyPoint& kpt, const Mat& img, const int* ofs, uchar* desc)
+{
+    const uchar* center = &img.at<uchar>(cvRound(kpt.pt.y), cvRound(kpt.pt.x));
 
-    for (int i = 0; i < 32; ++i, pattern += 16)//calculate the 256bit descriptor desc
+#if defined(__AVX2__) || defined(__SSE2__)
+    uchar CV_DECL_ALIGNED(32) t0[256], t1[256];
+    for (int i = 0; i < 256; ++i)
     {
-        int t0, t1, val;
-        t0 = GET_VALUE(0); t1 = GET_VALUE(1);
-        val = t0 < t1;//binary test: 1 when p(x)<p(y)
-        t0 = GET_VALUE(2); t1 = GET_VALUE(3);
-        val |= (t0 < t1) << 1;
-        t0 = GET_VALUE(4); t1 = GET_VALUE(5);
-        val |= (t0 < t1) << 2;
-        t0 = GET_VALUE(6); t1 = GET_VALUE(7);
-        val |= (t0 < t1) << 3;
-        t0 = GET_VALUE(8); t1 = GET_VALUE(9);
-        val |= (t0 < t1) << 4;
-        t0 = GET_VALUE(10); t1 = GET_VALUE(11);
-        val |= (t0 < t1) << 5;
-        t0 = GET_VALUE(12); t1 = GET_VALUE(13);
-        val |= (t0 < t1) << 6;
-        t0 = GET_VALUE(14); t1 = GET_VALUE(15);
-        val |= (t0 < t1) << 7;
-
+        t0[i] = center[ofs[2*i]];
+        t1[i] = center[ofs[2*i+1]];
+    }
+#ifdef __AVX2__
+    const __m256i delta = _mm256_set1_epi8((char)0x80);
+    for (int i = 0; i < 256; i += 32)
+    {
+        const __m256i v0 = _mm256_xor_si256(_mm256_load_si256((const __m256i*)(t0+i)), delta);
+        const __m256i v1 = _mm256_xor_si256(_mm256_load_si256((const __m256i*)(t1+i)), delta);
+        const unsigned int bits = (unsigned int)_mm256_movemask_epi8(_mm256_cmpgt_epi8(v1, v0));
+        memcpy(desc + i/8, &bits, 4);
+    }
+#else
+    const __m128i delta = _mm_set1_epi8((char)0x80);
+    for (int i = 0; i < 256; i += 16)
+    {
+        const __m128i v0 = _mm_xor_si128(_mm_load_si128((const __m128i*)(t0+i)), delta);
+        const __m128i v1 = _mm_xor_si128(_mm_load_si128((const __m128i*)(t1+i)), delta);
+        const unsigned short bits = (unsigned short)_mm_movemask_epi8(_mm_cmpgt_epi8(v1, v0));
+        memcpy(desc + i/8, &bits, 2);
+    }
+#endif
+#else
+    for (int i = 0; i < 32; ++i, ofs += 16)
+    {
+        int val = 0;
+        for (int j = 0; j < 8; ++j)
+            val |= (center[ofs[2*j]] < center[ofs[2*j+1]]) << j;
         desc[i] = (uchar)val;
     }
-
-    #undef GET_VALUE
+#endif
 }
 
 
@@ -408,9 +436,9 @@ static int bit_pattern_31_[256*4] =//every bit is from 2 points, every point has
 };
 
 ORBextractor::ORBextractor(int _nfeatures, float _scaleFactor, int _nlevels,
-         int _iniThFAST, int _minThFAST):
+         int _iniThFAST, int _minThFAST, int _nthreads):
     nfeatures(_nfeatures), scaleFactor(_scaleFactor), nlevels(_nlevels),
-    iniThFAST(_iniThFAST), minThFAST(_minThFAST)
+    iniThFAST(_iniThFAST), minThFAST(_minThFAST), mnActiveLevels(_nlevels), mbRGB(false), mnThreads(_nthreads), mnNextLevel(0), mpWorkerPool(NULL), mbMaskPyramidStatic(false)
 {
     mvScaleFactor.resize(nlevels);
     mvLevelSigma2.resize(nlevels);
@@ -431,24 +459,20 @@ ORBextractor::ORBextractor(int _nfeatures, float _scaleFactor, int _nlevels,
     }
 
     mvImagePyramid.resize(nlevels);
+    mvKeysLevel.resize(nlevels);
+    mvDescLevel.resize(nlevels);
+    mvNodePool.resize(nlevels);
+    mvMaskPyramid.resize(nlevels);
+    mvbLevelMasked.assign(nlevels, 0);
 
-    mnFeaturesPerLevel.resize(nlevels);
-    float factor = 1.0f / scaleFactor;//default 1/1.2
-    float nDesiredFeaturesPerScale = nfeatures*(1 - factor)/(1 - (float)pow((double)factor, (double)nlevels));//for the nfeatures is distributed in every level by geometric sequence TF=F0+F0*f+F0*f^2+...
-    //default 217
-
-    int sumFeatures = 0;
-    for( int level = 0; level < nlevels-1; level++ )
-    {
-        mnFeaturesPerLevel[level] = cvRound(nDesiredFeaturesPerScale);//cvRound use 0.5 to carry over when intpart is odd and truncate it when it's even for 0.000... this special unbalanced probability
-        sumFeatures += mnFeaturesPerLevel[level];
-        nDesiredFeaturesPerScale *= factor;
-    }
-    mnFeaturesPerLevel[nlevels-1] = std::max(nfeatures - sumFeatures, 0);//for the numerical error
+    ComputeFeaturesPerLevel();
 
     const int npoints = 512;
     const Point* pattern0 = (const Point*)bit_pattern_31_;//notice sizeof(Point)=8=2*sizeof(int)
     std::copy(pattern0, pattern0 + npoints, std::back_inserter(pattern));
+    makeRotatedPatterns(pattern, mvRotatedPattern);
+    mvPatternOffsets.resize(nlevels);
+    mvPatternStep.assign(nlevels, 0);
 
     //This is for the patch border(circular has different value(+/-umax) with varied v)
     // pre-compute the end of a row in a circular patch
@@ -479,7 +503,223 @@ static void computeOrientation(const Mat& image, vector<KeyPoint>& keypoints, co
     }
 }
 
-void ExtractorNode::DivideNode(ExtractorNode &n1, ExtractorNode &n2, ExtractorNode &n3, ExtractorNode &n4)
+static const int FAST_K = 8, FAST_N = 25;//9 contiguous pixels on the 16-pixel Bresenham circle
+
+static void makeFASTOffsets(int pixel[FAST_N], int step)//circle offsets in the order of cv::FAST, the first 9 are repeated for the wrap-around
+{
+    static const int offsets16[16][2] =
+    {
+        {0,  3}, { 1,  3}, { 2,  2}, { 3,  1}, { 3, 0}, { 3, -1}, { 2, -2}, { 1, -3},
+        {0, -3}, {-1, -3}, {-2, -2}, {-3, -1}, {-3, 0}, {-3,  1}, {-2,  2}, {-1,  3}
+    };
+    for(int k=0; k<16; k++)
+        pixel[k] = offsets16[k][0] + offsets16[k][1]*step;
+    for(int k=16; k<FAST_N; k++)
+        pixel[k] = pixel[k-16];
+}
+
+static int FAST9CornerScore(const uchar* ptr, const int pixel[], int threshold)//the cv::FAST score: max over 9-arcs of the min |I(p)-I(arc)|, minus 1; independent of threshold for a corner
+{
+    int k, v = ptr[0];
+    short d[FAST_N];
+    for(k = 0; k < FAST_N; k++)
+        d[k] = (short)(v - ptr[pixel[k]]);
+
+    int a0 = threshold;
+    for(k = 0; k < 16; k += 2)
+    {
+        int a = min((int)d[k+1], (int)d[k+2]);
+        a = min(a, (int)d[k+3]);
+        if(a <= a0)
+            continue;
+        a = min(a, (int)d[k+4]);
+        a = min(a, (int)d[k+5]);
+        a = min(a, (int)d[k+6]);
+        a = min(a, (int)d[k+7]);
+        a = min(a, (int)d[k+8]);
+        a0 = max(a0, min(a, (int)d[k]));
+        a0 = max(a0, min(a, (int)d[k+9]));
+    }
+
+    int b0 = -a0;
+    for(k = 0; k < 16; k += 2)
+    {
+        int b = max((int)d[k+1], (int)d[k+2]);
+        b = max(b, (int)d[k+3]);
+        b = max(b, (int)d[k+4]);
+        b = max(b, (int)d[k+5]);
+        if(b >= b0)
+            continue;
+        b = max(b, (int)d[k+6]);
+        b = max(b, (int)d[k+7]);
+        b = max(b, (int)d[k+8]);
+        b0 = min(b0, max(b, (int)d[k]));
+        b0 = min(b0, max(b, (int)d[k+9]));
+    }
+
+    return -b0-1;
+}
+
+static bool FAST9SegmentTest(const uchar* ptr, const int pixel[], int threshold)//scalar path, used for the row tails or when AVX2 is unavailable
+{
+    const int v = ptr[0];
+    const int vb = v+threshold, vd = v-threshold;
+
+    //any 9-arc covers two neighbouring compass points(0,4,8,12)
+    int nb = 0, nd = 0;
+    for(int k=0; k<16; k+=4)
+    {
+        const int x = ptr[pixel[k]];
+        nb += x>vb;
+        nd += x<vd;
+    }
+    if(nb<2 && nd<2)
+        return false;
+
+    int countb = 0, countd = 0;
+    for(int k=0; k<FAST_N; k++)
+    {
+        const int x = ptr[pixel[k]];
+        countb = x>vb ? countb+1 : 0;
+        countd = x<vd ? countd+1 : 0;
+        if(countb>FAST_K || countd>FAST_K)
+            return true;
+    }
+    return false;
+}
+
+//FAST-9 over the window [minX,maxX)x[minY,maxY) of image with 3x3 non-maximum suppression, same corners/scores as cv::FAST(,,true)
+//the 3 pixels around the window must be readable; keypoints are in image coordinates and in raster order
+//pixels where the optional mask(same size as image) is 0 are not tested at all
+static void FAST9Detect(const Mat& image, const Mat& mask, int minX, int minY, int maxX, int maxY, int threshold, vector<KeyPoint>& keypoints)
+{
+    keypoints.clear();
+    const uchar* data = image.data;
+    const int step = (int)image.step;
+    const int width = maxX-minX;
+    if(width<=0 || maxY<=minY)
+        return;
+    threshold = min(max(threshold, 0), 255);
+
+    int pixel[FAST_N];
+    makeFASTOffsets(pixel, step);
+
+    //3 rolling rows of scores & corner columns for the non-maximum suppression
+    vector<uchar> vScoreBuf(3*width);
+    vector<int> vCornerBuf(3*(width+1));
+    uchar* buf[3] = {&vScoreBuf[0], &vScoreBuf[width], &vScoreBuf[2*width]};
+    int* cpbuf[3] = {&vCornerBuf[1], &vCornerBuf[width+2], &vCornerBuf[2*width+3]};
+    cpbuf[0][-1] = cpbuf[1][-1] = cpbuf[2][-1] = 0;
+
+#ifdef __AVX2__
+    const __m256i delta = _mm256_set1_epi8((char)128), t = _mm256_set1_epi8((char)threshold), K16 = _mm256_set1_epi8((char)FAST_K);
+#endif
+
+    for(int i=minY; i<=maxY; i++)
+    {
+        uchar* curr = buf[(i-minY)%3];
+        int* cornerpos = cpbuf[(i-minY)%3];
+        int ncorners = 0;
+        memset(curr, 0, width);
+
+        if(i<maxY)
+        {
+            const uchar* ptr = data + i*step + minX;
+            const uchar* pmask = mask.empty() ? NULL : mask.ptr<uchar>(i) + minX;
+            int j = 0;
+#ifdef __AVX2__
+            //32 pixels at once like the SSE2 path of cv::FAST: signed compares after ^0x80, quick rejection by the compass points,
+            //then the longest run of brighter/darker circle pixels(>FAST_K means a 9-arc)
+            for(; j<=width-32; j+=32, ptr+=32)
+            {
+                unsigned int validmask = 0xffffffff;
+                if(pmask)
+                {
+                    const __m256i vmask = _mm256_loadu_si256((const __m256i*)(pmask + j));
+                    if(_mm256_testz_si256(vmask, vmask))//32 masked pixels cost only this test
+                        continue;
+                    validmask = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(vmask, _mm256_setzero_si256()));
+                }
+                __m256i v0 = _mm256_loadu_si256((const __m256i*)ptr);
+                const __m256i v1 = _mm256_xor_si256(_mm256_subs_epu8(v0, t), delta);
+                v0 = _mm256_xor_si256(_mm256_adds_epu8(v0, t), delta);
+
+                const __m256i x0 = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)(ptr + pixel[0])), delta);
+                const __m256i x1 = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)(ptr + pixel[4])), delta);
+                const __m256i x2 = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)(ptr + pixel[8])), delta);
+                const __m256i x3 = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)(ptr + pixel[12])), delta);
+                __m256i m0 = _mm256_and_si256(_mm256_cmpgt_epi8(x0, v0), _mm256_cmpgt_epi8(x1, v0));
+                __m256i m1 = _mm256_and_si256(_mm256_cmpgt_epi8(v1, x0), _mm256_cmpgt_epi8(v1, x1));
+                m0 = _mm256_or_si256(m0, _mm256_and_si256(_mm256_cmpgt_epi8(x1, v0), _mm256_cmpgt_epi8(x2, v0)));
+                m1 = _mm256_or_si256(m1, _mm256_and_si256(_mm256_cmpgt_epi8(v1, x1), _mm256_cmpgt_epi8(v1, x2)));
+                m0 = _mm256_or_si256(m0, _mm256_and_si256(_mm256_cmpgt_epi8(x2, v0), _mm256_cmpgt_epi8(x3, v0)));
+                m1 = _mm256_or_si256(m1, _mm256_and_si256(_mm256_cmpgt_epi8(v1, x2), _mm256_cmpgt_epi8(v1, x3)));
+                m0 = _mm256_or_si256(m0, _mm256_and_si256(_mm256_cmpgt_epi8(x3, v0), _mm256_cmpgt_epi8(x0, v0)));
+                m1 = _mm256_or_si256(m1, _mm256_and_si256(_mm256_cmpgt_epi8(v1, x3), _mm256_cmpgt_epi8(v1, x0)));
+                if(_mm256_movemask_epi8(_mm256_or_si256(m0, m1)) == 0)
+                    continue;
+
+                __m256i c0 = _mm256_setzero_si256(), c1 = c0, max0 = c0, max1 = c0;
+                for(int k=0; k<FAST_N; k++)
+                {
+                    const __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(ptr + pixel[k])), delta);
+                    m0 = _mm256_cmpgt_epi8(x, v0);
+                    m1 = _mm256_cmpgt_epi8(v1, x);
+                    c0 = _mm256_and_si256(_mm256_sub_epi8(c0, m0), m0);
+                    c1 = _mm256_and_si256(_mm256_sub_epi8(c1, m1), m1);
+                    max0 = _mm256_max_epu8(max0, c0);
+                    max1 = _mm256_max_epu8(max1, c1);
+                }
+                max0 = _mm256_max_epu8(max0, max1);
+                unsigned int m = (unsigned int)_mm256_movemask_epi8(_mm256_cmpgt_epi8(max0, K16)) & validmask;
+                while(m)
+                {
+                    const int k = __builtin_ctz(m);
+                    m &= m-1;
+                    cornerpos[ncorners++] = j+k;
+                    curr[j+k] = (uchar)FAST9CornerScore(ptr+k, pixel, threshold);
+                }
+            }
+#endif
+            for(; j<width; j++, ptr++)
+            {
+                if(pmask && !pmask[j])
+                    continue;
+                if(FAST9SegmentTest(ptr, pixel, threshold))
+                {
+                    cornerpos[ncorners++] = j;
+                    curr[j] = (uchar)FAST9CornerScore(ptr, pixel, threshold);
+                }
+            }
+        }
+
+        cornerpos[-1] = ncorners;
+
+        if(i==minY)
+            continue;
+
+        //non-maximum suppression of the previous row against its 8 neighbours
+        const uchar* prev = buf[(i-minY-1)%3];
+        const uchar* pprev = buf[(i-minY+1)%3];
+        const int* prevpos = cpbuf[(i-minY-1)%3];
+        const int nprev = prevpos[-1];
+        for(int k=0; k<nprev; k++)
+        {
+            const int j = prevpos[k];
+            const int score = prev[j];
+            if(i-1>minY && !(score > pprev[j] && (j==0 || score > pprev[j-1]) && (j==width-1 || score > pprev[j+1])))
+                continue;
+            if(!(score > curr[j] && (j==0 || score > curr[j-1]) && (j==width-1 || score > curr[j+1])))
+                continue;
+            if(!((j==0 || score > prev[j-1]) && (j==width-1 || score > prev[j+1])))
+                continue;
+            keypoints.push_back(KeyPoint((float)(minX+j), (float)(i-1), 7.f, -1, (float)score));
+        }
+    }
+}
+
+void ExtractorNode::DivideNode(ExtractorNode &n1, ExtractorNode &n2, ExtractorNode &n3, ExtractorNode &n4,
+                               const vector<KeyPoint> &vKeys, vector<int> &vKeyIdx, vector<int> &vScratch)
 {
     const int halfX = ceil(static_cast<float>(UR.x-UL.x)/2);
     const int halfY = ceil(static_cast<float>(BR.y-UL.y)/2);
@@ -489,250 +729,199 @@ void ExtractorNode::DivideNode(ExtractorNode &n1, ExtractorNode &n2, ExtractorNo
     n1.UR = cv::Point2i(UL.x+halfX,UL.y);
     n1.BL = cv::Point2i(UL.x,UL.y+halfY);
     n1.BR = cv::Point2i(UL.x+halfX,UL.y+halfY);
-    n1.vKeys.reserve(vKeys.size());
 
     n2.UL = n1.UR;
     n2.UR = UR;
     n2.BL = n1.BR;
     n2.BR = cv::Point2i(UR.x,UL.y+halfY);
-    n2.vKeys.reserve(vKeys.size());
 
     n3.UL = n1.BL;
     n3.UR = n1.BR;
     n3.BL = BL;
     n3.BR = cv::Point2i(n1.BR.x,BL.y);
-    n3.vKeys.reserve(vKeys.size());
 
     n4.UL = n3.UR;
     n4.UR = n2.BR;
     n4.BL = n3.BR;
     n4.BR = BR;
-    n4.vKeys.reserve(vKeys.size());
 
-    //Associate points to childs
-    for(size_t i=0;i<vKeys.size();i++)
+    //Associate points to childs: count them, then scatter in the original order
+    ExtractorNode* pChilds[4] = {&n1, &n2, &n3, &n4};
+    int nCount[4] = {0, 0, 0, 0};
+    for(int i=nBegin;i<nEnd;i++)
+    {
+        const cv::KeyPoint &kp = vKeys[vKeyIdx[i]];
+        ++nCount[(kp.pt.x<n1.UR.x?0:1) + (kp.pt.y<n1.BR.y?0:2)];
+    }
+    int nCursor[4];
+    for(int c=0, begin=nBegin; c<4; c++)
+    {
+        pChilds[c]->nBegin = nCursor[c] = begin;
+        begin += nCount[c];
+        pChilds[c]->nEnd = begin;
+    }
+    for(int i=nBegin;i<nEnd;i++)
+    {
+        const cv::KeyPoint &kp = vKeys[vKeyIdx[i]];
+        vScratch[nCursor[(kp.pt.x<n1.UR.x?0:1) + (kp.pt.y<n1.BR.y?0:2)]++] = vKeyIdx[i];
+    }
+    std::copy(vScratch.begin()+nBegin, vScratch.begin()+nEnd, vKeyIdx.begin()+nBegin);
+
+    for(int c=0; c<4; c++)//if there's only 1 point in the child, it won't be divided again;if ni is 0,it will be discarded
+        pChilds[c]->bNoMore = pChilds[c]->size()==1;
+}
+
+void ExtractorNodePool::PushFront(int idx)
+{
+    ExtractorNode &node = vNodes[idx];
+    node.nPrev = -1;
+    node.nNext = nHead;
+    if(nHead!=-1)
+        vNodes[nHead].nPrev = idx;
+    nHead = idx;
+    ++nSize;
+}
+
+void ExtractorNodePool::Erase(int idx)
+{
+    ExtractorNode &node = vNodes[idx];
+    if(node.nPrev!=-1)
+        vNodes[node.nPrev].nNext = node.nNext;
+    else
+        nHead = node.nNext;
+    if(node.nNext!=-1)
+        vNodes[node.nNext].nPrev = node.nPrev;
+    --nSize;
+}
+
+//divide vNodes[idx] and replace it by its non-empty childs at the front of the list, returns the number of childs to be expanded
+static int ExpandNode(ExtractorNodePool &pool, const int idx, const vector<KeyPoint> &vKeys)
+{
+    ExtractorNode n[4];
+    pool.vNodes[idx].DivideNode(n[0],n[1],n[2],n[3],vKeys,pool.vKeyIdx,pool.vScratch);
+
+    int nToExpand = 0;
+    for(int c=0; c<4; c++)
     {
-        const cv::KeyPoint &kp = vKeys[i];
-        if(kp.pt.x<n1.UR.x)
+        // Add childs if they contain points
+        if(n[c].size()>0)
         {
-            if(kp.pt.y<n1.BR.y)
-                n1.vKeys.push_back(kp);
-            else
-                n3.vKeys.push_back(kp);
+            pool.vNodes.push_back(n[c]);//may reallocate vNodes, so only indices are kept
+            const int idxChild = pool.vNodes.size()-1;
+            pool.PushFront(idxChild);
+            if(n[c].size()>1)
+            {
+                nToExpand++;
+                pool.vSizeAndNode.push_back(make_pair(n[c].size(),idxChild));
+            }
         }
-        else if(kp.pt.y<n1.BR.y)
-            n2.vKeys.push_back(kp);
-        else
-            n4.vKeys.push_back(kp);
     }
+    pool.Erase(idx);
 
-    if(n1.vKeys.size()==1)//if there's only 1 point in the child, it won't be divided again
-        n1.bNoMore = true;
-    if(n2.vKeys.size()==1)//if ni is 0,it will be discarded
-        n2.bNoMore = true;
-    if(n3.vKeys.size()==1)
-        n3.bNoMore = true;
-    if(n4.vKeys.size()==1)
-        n4.bNoMore = true;
-
+    return nToExpand;
 }
 
-vector<cv::KeyPoint> ORBextractor::DistributeOctTree(const vector<cv::KeyPoint>& vToDistributeKeys, const int &minX,
-                                       const int &maxX, const int &minY, const int &maxY, const int &N, const int &level)//here level is unused!
+void ORBextractor::DistributeOctTree(const vector<cv::KeyPoint>& vToDistributeKeys, const int &minX,
+                                     const int &maxX, const int &minY, const int &maxY, const int &N, const int &level,
+                                     vector<cv::KeyPoint>& vResultKeys)
 {
+    ExtractorNodePool &pool = mvNodePool[level];//each level has its own arena, so the levels can be distributed in parallel
+    vector<ExtractorNode> &vNodes = pool.vNodes;
+    vNodes.clear();
+    pool.nHead = -1;
+    pool.nSize = 0;
+
     // Compute how many initial nodes(notice it's initially divided as possibly as every node is a square,and it can not handle too thin rectangle)
     const int nIni = round(static_cast<float>(maxX-minX)/(maxY-minY));//2
 
     const float hX = static_cast<float>(maxX-minX)/nIni;//966/2=483
 
-    list<ExtractorNode> lNodes;
-
-    vector<ExtractorNode*> vpIniNodes;//use pointer as the vector content for fast variable size of the content
-    vpIniNodes.resize(nIni);
-
+    vNodes.resize(nIni);
     for(int i=0; i<nIni; i++)//divide the initial image (raw+ 3*2rows/cols) into nIni nodes
     {
-        ExtractorNode ni;
+        ExtractorNode &ni = vNodes[i];
         ni.UL = cv::Point2i(hX*static_cast<float>(i),0);
         ni.UR = cv::Point2i(hX*static_cast<float>(i+1),0);
         ni.BL = cv::Point2i(ni.UL.x,maxY-minY);
         ni.BR = cv::Point2i(ni.UR.x,maxY-minY);
-        ni.vKeys.reserve(vToDistributeKeys.size());
-
-        lNodes.push_back(ni);
-        vpIniNodes[i] = &lNodes.back();
     }
 
-    //Associate points to childs
-    for(size_t i=0;i<vToDistributeKeys.size();i++)
+    //Associate points to childs: the keypoints of node i are vKeyIdx[nBegin,nEnd) in their original order
+    const int nKeys = vToDistributeKeys.size();
+    pool.vKeyIdx.resize(nKeys);
+    pool.vScratch.resize(nKeys);
+    for(int k=0;k<nKeys;k++)
+        ++vNodes[vToDistributeKeys[k].pt.x/hX].nEnd;//no offset problem for the reason pt.x/y starts from minX/Y;maybe discard the vec.end() node to solve the border limit problem
+    for(int i=0, begin=0; i<nIni; i++)
     {
-        const cv::KeyPoint &kp = vToDistributeKeys[i];
-        vpIniNodes[kp.pt.x/hX]->vKeys.push_back(kp);//no offset problem for the reason pt.x/y starts from minX/Y;maybe discard the vec.end() node to solve the border limit problem
+        vNodes[i].nEnd += begin;
+        vNodes[i].nBegin = begin = vNodes[i].nEnd;//filled backwards below
     }
+    for(int k=nKeys-1;k>=0;k--)
+        pool.vKeyIdx[--vNodes[vToDistributeKeys[k].pt.x/hX].nBegin] = k;
 
-    list<ExtractorNode>::iterator lit = lNodes.begin();
-
-    while(lit!=lNodes.end())
+    for(int i=nIni-1; i>=0; i--)//link the non-empty nodes in the order 0..nIni-1
     {
-        if(lit->vKeys.size()==1)
-        {
-            lit->bNoMore=true;
-            lit++;
-        }
-        else if(lit->vKeys.empty())
-            lit = lNodes.erase(lit);
-        else//if it can be divided or lit->vKeys.size()>1
-            lit++;
+        if(vNodes[i].size()==0)
+            continue;
+        vNodes[i].bNoMore = vNodes[i].size()==1;
+        pool.PushFront(i);
     }
 
     bool bFinish = false;
 
-    int iteration = 0;
-
-    vector<pair<int,ExtractorNode*> > vSizeAndPointerToNode;
-    vSizeAndPointerToNode.reserve(lNodes.size()*4);//8
+    vector<pair<int,int> > &vSizeAndNode = pool.vSizeAndNode;
 
     while(!bFinish)
     {
-        iteration++;
-
-        int prevSize = lNodes.size();
-
-        lit = lNodes.begin();
+        int prevSize = pool.nSize;
 
         int nToExpand = 0;
 
-        vSizeAndPointerToNode.clear();
+        vSizeAndNode.clear();
 
-        while(lit!=lNodes.end())
+        for(int idx=pool.nHead; idx!=-1; )
         {
-            if(lit->bNoMore)
-            {
-                // If node only contains one point do not subdivide and continue
-                lit++;
-                continue;
-            }
-            else
-            {
-                // If more than one point, subdivide
-                ExtractorNode n1,n2,n3,n4;
-                lit->DivideNode(n1,n2,n3,n4);
-
-                // Add childs if they contain points
-                if(n1.vKeys.size()>0)
-                {
-                    lNodes.push_front(n1);                    
-                    if(n1.vKeys.size()>1)
-                    {
-                        nToExpand++;
-                        vSizeAndPointerToNode.push_back(make_pair(n1.vKeys.size(),&lNodes.front()));
-                        lNodes.front().lit = lNodes.begin();//record itself
-                    }
-                }
-                if(n2.vKeys.size()>0)
-                {
-                    lNodes.push_front(n2);
-                    if(n2.vKeys.size()>1)
-                    {
-                        nToExpand++;
-                        vSizeAndPointerToNode.push_back(make_pair(n2.vKeys.size(),&lNodes.front()));
-                        lNodes.front().lit = lNodes.begin();
-                    }
-                }
-                if(n3.vKeys.size()>0)
-                {
-                    lNodes.push_front(n3);
-                    if(n3.vKeys.size()>1)
-                    {
-                        nToExpand++;
-                        vSizeAndPointerToNode.push_back(make_pair(n3.vKeys.size(),&lNodes.front()));
-                        lNodes.front().lit = lNodes.begin();
-                    }
-                }
-                if(n4.vKeys.size()>0)
-                {
-                    lNodes.push_front(n4);
-                    if(n4.vKeys.size()>1)
-                    {
-                        nToExpand++;
-                        vSizeAndPointerToNode.push_back(make_pair(n4.vKeys.size(),&lNodes.front()));
-                        lNodes.front().lit = lNodes.begin();
-                    }
-                }
-
-                lit=lNodes.erase(lit);
-                continue;
-            }
-        }       
+            const int idxNext = vNodes[idx].nNext;//childs are pushed to the front, so they're not visited in this pass
+            if(!vNodes[idx].bNoMore)// If more than one point, subdivide
+                nToExpand += ExpandNode(pool, idx, vToDistributeKeys);
+            idx = idxNext;
+        }
 
         // Finish if there are more nodes than required features
         // or all nodes contain just one point/no nodes have been subdivided
-        if((int)lNodes.size()>=N || (int)lNodes.size()==prevSize)//notice size cannot be less than before
+        if(pool.nSize>=N || pool.nSize==prevSize)//notice size cannot be less than before
         {
             bFinish = true;
         }
-        else if(((int)lNodes.size()+nToExpand*3)>N)//subdivide one node can mostly contribute 4-1 nodes, check if the most contribution situation can lead to enough/N features, if not, no need to sort!
+        else if((pool.nSize+nToExpand*3)>N)//subdivide one node can mostly contribute 4-1 nodes, check if the most contribution situation can lead to enough/N features, if not, no need to sort!
         {
 
             while(!bFinish)
             {
 
-                prevSize = lNodes.size();
+                prevSize = pool.nSize;
 
-                vector<pair<int,ExtractorNode*> > vPrevSizeAndPointerToNode = vSizeAndPointerToNode;
-                vSizeAndPointerToNode.clear();
+                vector<pair<int,int> > &vPrevSizeAndNode = pool.vPrevSizeAndNode;
+                vPrevSizeAndNode.swap(vSizeAndNode);
+                vSizeAndNode.clear();
 
-                sort(vPrevSizeAndPointerToNode.begin(),vPrevSizeAndPointerToNode.end());//sort is important for individual subdivision here instead of an outer normal order
-                for(int j=vPrevSizeAndPointerToNode.size()-1;j>=0;j--)//heuristical subdivide: firstly choose the larger size(it seems to contribute more nodes)
+                //heuristical subdivide: firstly choose the larger size(it seems to contribute more nodes), ties by the later created node;
+                //a heap only orders the nodes really divided before N is reached
+                make_heap(vPrevSizeAndNode.begin(),vPrevSizeAndNode.end());
+                while(!vPrevSizeAndNode.empty())
                 {
-                    ExtractorNode n1,n2,n3,n4;
-                    vPrevSizeAndPointerToNode[j].second->DivideNode(n1,n2,n3,n4);
-
-                    // Add childs if they contain points
-                    if(n1.vKeys.size()>0)
-                    {
-                        lNodes.push_front(n1);
-                        if(n1.vKeys.size()>1)
-                        {
-                            vSizeAndPointerToNode.push_back(make_pair(n1.vKeys.size(),&lNodes.front()));
-                            lNodes.front().lit = lNodes.begin();
-                        }
-                    }
-                    if(n2.vKeys.size()>0)
-                    {
-                        lNodes.push_front(n2);
-                        if(n2.vKeys.size()>1)
-                        {
-                            vSizeAndPointerToNode.push_back(make_pair(n2.vKeys.size(),&lNodes.front()));
-                            lNodes.front().lit = lNodes.begin();
-                        }
-                    }
-                    if(n3.vKeys.size()>0)
-                    {
-                        lNodes.push_front(n3);
-                        if(n3.vKeys.size()>1)
-                        {
-                            vSizeAndPointerToNode.push_back(make_pair(n3.vKeys.size(),&lNodes.front()));
-                            lNodes.front().lit = lNodes.begin();
-                        }
-                    }
-                    if(n4.vKeys.size()>0)
-                    {
-                        lNodes.push_front(n4);
-                        if(n4.vKeys.size()>1)
-                        {
-                            vSizeAndPointerToNode.push_back(make_pair(n4.vKeys.size(),&lNodes.front()));
-                            lNodes.front().lit = lNodes.begin();
-                        }
-                    }
+                    pop_heap(vPrevSizeAndNode.begin(),vPrevSizeAndNode.end());
+                    const int idx = vPrevSizeAndNode.back().second;
+                    vPrevSizeAndNode.pop_back();
 
-                    lNodes.erase(vPrevSizeAndPointerToNode[j].second->lit);//here lit just record the ExtractorNode::Iterator itself not for the list structure pointer
+                    ExpandNode(pool, idx, vToDistributeKeys);
 
-                    if((int)lNodes.size()>=N)
+                    if(pool.nSize>=N)
                         break;
                 }
 
-                if((int)lNodes.size()>=N || (int)lNodes.size()==prevSize)
+                if(pool.nSize>=N || pool.nSize==prevSize)
                     bFinish = true;
 
             }
@@ -741,117 +930,123 @@ vector<cv::KeyPoint> ORBextractor::DistributeOctTree(const vector<cv::KeyPoint>&
 
     // Retain the best point in each node/to avoid too many same place keypoints(at the same level image)
     //using the FAST score calculated by nonmaxsuppression method(.response similar to RetainBest()), not to use the Harris Score+RetainBest() to select the approximate max nfeatures/N features like opencv version
-    vector<cv::KeyPoint> vResultKeys;
-    vResultKeys.reserve(nfeatures);
-    for(list<ExtractorNode>::iterator lit=lNodes.begin(); lit!=lNodes.end(); lit++)
+    vResultKeys.clear();
+    vResultKeys.reserve(pool.nSize);
+    for(int idx=pool.nHead; idx!=-1; idx=vNodes[idx].nNext)
     {
-        vector<cv::KeyPoint> &vNodeKeys = lit->vKeys;
-        cv::KeyPoint* pKP = &vNodeKeys[0];
-        float maxResponse = pKP->response;//can directly use vNodeKeys[0].response!
+        const ExtractorNode &node = vNodes[idx];
+        int kBest = pool.vKeyIdx[node.nBegin];
+        float maxResponse = vToDistributeKeys[kBest].response;
 
-        for(size_t k=1;k<vNodeKeys.size();k++)
+        for(int i=node.nBegin+1;i<node.nEnd;i++)
         {
-            if(vNodeKeys[k].response>maxResponse)//response is calculated by FAST using max{min10brights,min10darks}>Threshold method similar to "Machine learning for high-speed corner detection"
+            const int k = pool.vKeyIdx[i];
+            if(vToDistributeKeys[k].response>maxResponse)//response is calculated by FAST using max{min10brights,min10darks}>Threshold method similar to "Machine learning for high-speed corner detection"
             {
-                pKP = &vNodeKeys[k];//or use int max_k to record the max response index
-                maxResponse = vNodeKeys[k].response;
+                kBest = k;
+                maxResponse = vToDistributeKeys[k].response;
             }
         }
 
-        vResultKeys.push_back(*pKP);
+        vResultKeys.push_back(vToDistributeKeys[kBest]);
     }
-
-    return vResultKeys;
 }
 
 void ORBextractor::ComputeKeyPointsOctTree(vector<vector<KeyPoint> >& allKeypoints)
 {
     allKeypoints.resize(nlevels);
 
-    const float W = 30;
-
     for (int level = 0; level < nlevels; ++level)
-    {
-        const int minBorderX = EDGE_THRESHOLD-3;//just use EdgTh inner part(raw is shrinked) of the mvImagePyramid[level]!!
-        const int minBorderY = minBorderX;
-        const int maxBorderX = mvImagePyramid[level].cols-EDGE_THRESHOLD+3;//[min,max)
-        const int maxBorderY = mvImagePyramid[level].rows-EDGE_THRESHOLD+3;
-
-        vector<cv::KeyPoint> vToDistributeKeys;
-        vToDistributeKeys.reserve(nfeatures*10);
-
-        const float width = (maxBorderX-minBorderX);
-        const float height = (maxBorderY-minBorderY);
+        ComputeKeyPointsLevel(level, allKeypoints[level]);
+}
 
-        const int nCols = width/W;//32
-        const int nRows = height/W;//18
-        const int wCell = ceil(width/nCols);//about W
-        const int hCell = ceil(height/nRows);//about W,here is W
+void ORBextractor::ComputeKeyPointsLevel(const int &level, vector<KeyPoint>& keypoints)
+{
+    const float W = 30;
 
-        for(int i=0; i<nRows; i++)
-        {
-            const float iniY =minBorderY+i*hCell;
-            float maxY = iniY+hCell+6;//use at least raw image + 3*2 rows/cols as the cell
+    const int minBorderX = EDGE_THRESHOLD-3;//just use EdgTh inner part(raw is shrinked) of the mvImagePyramid[level]!!
+    const int minBorderY = minBorderX;
+    const int maxBorderX = mvImagePyramid[level].cols-EDGE_THRESHOLD+3;//[min,max)
+    const int maxBorderY = mvImagePyramid[level].rows-EDGE_THRESHOLD+3;
 
-            if(iniY>=maxBorderY-3)//if iniY is already out of the raw image(without the extrapolation part)=>jump over the processing
-                continue;
-            if(maxY>maxBorderY)
-                maxY = maxBorderY;
+    vector<cv::KeyPoint> vToDistributeKeys;
+    vToDistributeKeys.reserve(nfeatures*10);
 
-            for(int j=0; j<nCols; j++)
-            {
-                const float iniX =minBorderX+j*wCell;
-                float maxX = iniX+wCell+6;
-                if(iniX>=maxBorderX-6)
-                    continue;
-                if(maxX>maxBorderX)
-                    maxX = maxBorderX;
+    const float width = (maxBorderX-minBorderX);
+    const float height = (maxBorderY-minBorderY);
 
-                vector<cv::KeyPoint> vKeysCell;
-                FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                     vKeysCell,iniThFAST,true);
-
-                if(vKeysCell.empty())//when iniThFAST is invalid then use minimum FAST threshold
-                {
-                    FAST(mvImagePyramid[level].rowRange(iniY,maxY).colRange(iniX,maxX),
-                         vKeysCell,minThFAST,true);
-                }
+    const int nCols = width/W;//32
+    const int nRows = height/W;//18
+    const int wCell = ceil(width/nCols);//about W
+    const int hCell = ceil(height/nRows);//about W,here is W
 
-                if(!vKeysCell.empty())
+    if(nCols>0&&nRows>0&&!mvbLevelMasked[level])//a fully masked level costs nothing
+    {
+        //one FAST pass over the whole level instead of 2 cv::FAST calls per cell: the score of a corner doesn't depend on the threshold,
+        //so the iniThFAST corners of a cell are the lower threshold ones with response>=iniThFAST
+        const int thLow = min(iniThFAST,minThFAST);
+        vector<cv::KeyPoint> vKeysLevel;
+        vKeysLevel.reserve(nfeatures*10);
+        FAST9Detect(mvImagePyramid[level],mvMaskPyramid[level],minBorderX+3,minBorderY+3,maxBorderX-3,maxBorderY-3,thLow,vKeysLevel);
+
+        //bucket the corners into the old cells(each cell detected on [iniX+3,iniX+wCell+3)), keeping the raster order inside a cell
+        const int nCells = nRows*nCols;
+        vector<int> vCellOfKey(vKeysLevel.size());
+        vector<int> vCellStart(nCells+1,0);
+        for(size_t k=0; k<vKeysLevel.size(); k++)
+        {
+            const int i = ((int)vKeysLevel[k].pt.y-minBorderY-3)/hCell;
+            const int j = ((int)vKeysLevel[k].pt.x-minBorderX-3)/wCell;
+            vCellOfKey[k] = i*nCols+j;
+            ++vCellStart[vCellOfKey[k]+1];
+        }
+        for(int c=0; c<nCells; c++)
+            vCellStart[c+1] += vCellStart[c];
+        vector<int> vCellKeys(vKeysLevel.size());
+        vector<int> vCellFill(vCellStart.begin(),vCellStart.end()-1);
+        for(size_t k=0; k<vKeysLevel.size(); k++)
+            vCellKeys[vCellFill[vCellOfKey[k]]++] = k;
+
+        for(int c=0; c<nCells; c++)
+        {
+            bool bIniTh = false;
+            for(int k=vCellStart[c]; k<vCellStart[c+1]; k++)
+                if(vKeysLevel[vCellKeys[k]].response>=iniThFAST)
                 {
-                    for(vector<cv::KeyPoint>::iterator vit=vKeysCell.begin(); vit!=vKeysCell.end();vit++)
-                    {
-                        (*vit).pt.x+=j*wCell;//don't need to +minBorderX for a same start place is enough to divide them by quadTree/2d-octTree
-                        (*vit).pt.y+=i*hCell;
-                        vToDistributeKeys.push_back(*vit);
-                    }
+                    bIniTh = true;
+                    break;
                 }
+            const int th = bIniTh?iniThFAST:minThFAST;//when iniThFAST is invalid then use minimum FAST threshold
 
+            for(int k=vCellStart[c]; k<vCellStart[c+1]; k++)
+            {
+                cv::KeyPoint &kp = vKeysLevel[vCellKeys[k]];
+                if(kp.response<th)
+                    continue;
+                kp.pt.x-=minBorderX;//FAST ran on the whole level, so move it into the DistributeOctTree() frame starting at minBorder, added back below
+                kp.pt.y-=minBorderY;
+                vToDistributeKeys.push_back(kp);
             }
         }
+    }
 
-        vector<KeyPoint> & keypoints = allKeypoints[level];
-        keypoints.reserve(nfeatures);//this size may slightly > the mnFeaturesPerLevel[level]
-
-        keypoints = DistributeOctTree(vToDistributeKeys, minBorderX, maxBorderX,
-                                      minBorderY, maxBorderY,mnFeaturesPerLevel[level], level);
+    DistributeOctTree(vToDistributeKeys, minBorderX, maxBorderX,
+                      minBorderY, maxBorderY,mnFeaturesPerLevel[level], level, keypoints);//this size may slightly > the mnFeaturesPerLevel[level]
 
-        const int scaledPatchSize = PATCH_SIZE*mvScaleFactor[level];
+    const int scaledPatchSize = PATCH_SIZE*mvScaleFactor[level];
 
-        // Add border to coordinates and scale information
-        const int nkps = keypoints.size();
-        for(int i=0; i<nkps ; i++)
-        {
-            keypoints[i].pt.x+=minBorderX;//need to add back the offset/EdgTh-3
-            keypoints[i].pt.y+=minBorderY;
-            keypoints[i].octave=level;
-            keypoints[i].size = scaledPatchSize;//equivalent diameter of the meaningful keypoint neighborhood at the level==0
-        }
+    // Add border to coordinates and scale information
+    const int nkps = keypoints.size();
+    for(int i=0; i<nkps ; i++)
+    {
+        keypoints[i].pt.x+=minBorderX;//need to add back the offset/EdgTh-3
+        keypoints[i].pt.y+=minBorderY;
+        keypoints[i].octave=level;
+        keypoints[i].size = scaledPatchSize;//equivalent diameter of the meaningful keypoint neighborhood at the level==0
     }
 
     // compute orientations
-    for (int level = 0; level < nlevels; ++level)
-        computeOrientation(mvImagePyramid[level], allKeypoints[level], umax);
+    computeOrientation(mvImagePyramid[level], keypoints, umax);
 }
 
 void ORBextractor::ComputeKeyPointsOld(std::vector<std::vector<KeyPoint> > &allKeypoints)//finally unused function! && not use Harris Score to select N features like opencv
@@ -1036,12 +1231,18 @@ void ORBextractor::ComputeKeyPointsOld(std::vector<std::vector<KeyPoint> > &allK
 }
 
 static void computeDescriptors(const Mat& image, vector<KeyPoint>& keypoints, Mat& descriptors,
-                               const vector<Point>& pattern)
+                               const vector<int>& patternOffsets)
 {
-    descriptors = Mat::zeros((int)keypoints.size(), 32, CV_8UC1);//N*32 * 8bitChannel1
+    CV_Assert(descriptors.rows == (int)keypoints.size() && descriptors.cols == 32 && descriptors.type() == CV_8UC1);//N*32 * 8bitChannel1, every byte is written
 
+    const int npoints = (int)patternOffsets.size()/ANGLE_BINS;
     for (size_t i = 0; i < keypoints.size(); i++)
-        computeOrbDescriptor(keypoints[i], image, &pattern[0], descriptors.ptr((int)i));
+    {
+        int bin = cvRound(keypoints[i].angle*(ANGLE_BINS/360.f));
+        if (bin >= ANGLE_BINS) bin -= ANGLE_BINS;
+        else if (bin < 0) bin += ANGLE_BINS;
+        computeOrbDescriptor(keypoints[i], image, &patternOffsets[bin*npoints], descriptors.ptr((int)i));
+    }
 }
 
 void ORBextractor::operator()( InputArray _image, InputArray _mask, vector<KeyPoint>& _keypoints,
@@ -1051,20 +1252,57 @@ void ORBextractor::operator()( InputArray _image, InputArray _mask, vector<KeyPo
         return;
 
     Mat image = _image.getMat();
-    assert(image.type() == CV_8UC1 );//canonly process Gray Image
+    assert(image.type() == CV_8UC1 || image.type() == CV_8UC3 || image.type() == CV_8UC4);//color is converted in ComputePyramid()
+
+    // Combine the dynamic mask of this image with the static one
+    Mat mask = _mask.getMat();
+    if (!mask.empty() && (mask.type() != CV_8UC1 || mask.size() != image.size()))
+        mask = Mat();//a wrong dynamic mask is ignored like mStaticMask below, it would be read out of bounds
+    const bool bStaticMask = mask.empty();
+    if (!mStaticMask.empty() && mStaticMask.size() == image.size())
+    {
+        if (mask.empty())
+            mask = mStaticMask;
+        else
+        {
+            bitwise_and(mask, mStaticMask, mMaskBuffer);
+            mask = mMaskBuffer;
+        }
+    }
 
     // Pre-compute the scale pyramid
     ComputePyramid(image);
-
-    vector < vector<KeyPoint> > allKeypoints;
-    ComputeKeyPointsOctTree(allKeypoints);
-    //ComputeKeyPointsOld(allKeypoints);
+    ComputeMaskPyramid(mask, bStaticMask);
+
+    // Detection, distribution, blur and description of every level are independent tasks
+    for (int level = mnActiveLevels; level < nlevels; ++level)
+        mvKeysLevel[level].clear();
+    mnNextLevel = 0;
+    const int nWorkers = min(mnThreads, mnActiveLevels);
+    if (mpWorkerPool)
+    {
+        vector<future<void> > vFutures;
+        for (int i = 1; i < nWorkers; ++i)
+            vFutures.push_back(mpWorkerPool->Submit(bind(&ORBextractor::ExtractLevelsWorker, this)));
+        ExtractLevelsWorker();//the calling thread also takes levels
+        for (size_t i = 0; i < vFutures.size(); ++i)
+            mpWorkerPool->Wait(vFutures[i]);
+    }
+    else
+    {
+        vector<thread> vThreads;
+        for (int i = 1; i < nWorkers; ++i)
+            vThreads.push_back(thread(&ORBextractor::ExtractLevelsWorker, this));
+        ExtractLevelsWorker();
+        for (size_t i = 0; i < vThreads.size(); ++i)
+            vThreads[i].join();
+    }
 
     Mat descriptors;
 
     int nkeypoints = 0;
     for (int level = 0; level < nlevels; ++level)
-        nkeypoints += (int)allKeypoints[level].size();
+        nkeypoints += (int)mvKeysLevel[level].size();
     if( nkeypoints == 0 )
         _descriptors.release();//it no keypoints make the _descriptors be empty/cv::Mat()
     else
@@ -1076,63 +1314,226 @@ void ORBextractor::operator()( InputArray _image, InputArray _mask, vector<KeyPo
     _keypoints.clear();
     _keypoints.reserve(nkeypoints);
 
+    // Gather the levels in order, so the output doesn't depend on which worker finished first
     int offset = 0;
     for (int level = 0; level < nlevels; ++level)
     {
-        vector<KeyPoint>& keypoints = allKeypoints[level];
+        vector<KeyPoint>& keypoints = mvKeysLevel[level];
         int nkeypointsLevel = (int)keypoints.size();
 
         if(nkeypointsLevel==0)
             continue;
 
-        // preprocess the resized image
-        Mat workingMat = mvImagePyramid[level].clone();//use clone() for GaussianBlur
-        GaussianBlur(workingMat, workingMat, Size(7, 7), 2, 2, BORDER_REFLECT_101);//use 7*7 Gaussian convolution kernel with sigmax/y=2/2 to blur/filter workingMat
-	//maybe better to use GaussianBlur(mvImagePyramid[level],workingMat,...)!
-
-        // Compute the descriptors
-        Mat desc = descriptors.rowRange(offset, offset + nkeypointsLevel);
-        computeDescriptors(workingMat, keypoints, desc, pattern);
-
+        mvDescLevel[level].rowRange(0, nkeypointsLevel).copyTo(descriptors.rowRange(offset, offset + nkeypointsLevel));
         offset += nkeypointsLevel;
 
-        // Scale keypoint coordinates
-        if (level != 0)
-        {
-            float scale = mvScaleFactor[level]; //getScale(level, firstLevel, scaleFactor);//<-this is the old slower method in opencv
-            for (vector<KeyPoint>::iterator keypoint = keypoints.begin(),
-                 keypointEnd = keypoints.end(); keypoint != keypointEnd; ++keypoint)
-                keypoint->pt *= scale;
-        }
         // And add the keypoints to the output
         _keypoints.insert(_keypoints.end(), keypoints.begin(), keypoints.end());//notice the nkeypointslevel<=mnFeaturesPerLevel[level]
     }
 }
 
-void ORBextractor::ComputePyramid(cv::Mat image)
+void ORBextractor::ExtractLevelsWorker()
+{
+    for (int level = mnNextLevel++; level < mnActiveLevels; level = mnNextLevel++)//level 0 is the most expensive one and is taken first
+        ExtractLevel(level);
+}
+
+void ORBextractor::ExtractLevel(const int &level)
+{
+    vector<KeyPoint>& keypoints = mvKeysLevel[level];
+    ComputeKeyPointsLevel(level, keypoints);
+
+    if(keypoints.empty())
+        return;
+
+    // preprocess the resized image
+    Mat &workingMat = mvBlurBuffer[level];
+    GaussianBlur(mvImagePyramid[level], workingMat, Size(7, 7), 2, 2, BORDER_REFLECT_101);//use 7*7 Gaussian convolution kernel with sigmax/y=2/2 to blur/filter workingMat
+    //the 3 pixels outside the ROI come from the reflected border of mvPyramidBuffer, the same as blurring a clone()
+
+    // Compute the descriptors
+    if (mvPatternStep[level] != (int)workingMat.step)
+    {
+        makePatternOffsets(mvRotatedPattern, (int)workingMat.step, mvPatternOffsets[level]);
+        mvPatternStep[level] = (int)workingMat.step;
+    }
+    if (mvDescLevel[level].rows < (int)keypoints.size())//grows only, the level's rows are rowRange(0,keypoints.size())
+        mvDescLevel[level].create(max((int)keypoints.size(), 2*mnFeaturesPerLevel[level]), 32, CV_8UC1);
+    Mat desc = mvDescLevel[level].rowRange(0, (int)keypoints.size());
+    computeDescriptors(workingMat, keypoints, desc, mvPatternOffsets[level]);
+
+    // Scale keypoint coordinates
+    if (level != 0)
+    {
+        float scale = mvScaleFactor[level]; //getScale(level, firstLevel, scaleFactor);//<-this is the old slower method in opencv
+        for (vector<KeyPoint>::iterator keypoint = keypoints.begin(),
+             keypointEnd = keypoints.end(); keypoint != keypointEnd; ++keypoint)
+            keypoint->pt *= scale;
+    }
+}
+
+void ORBextractor::AllocatePyramid(const cv::Size &imageSize)
 {
+    mImageSize = imageSize;
+    mvPyramidBuffer.resize(nlevels);
+    mvBlurBuffer.resize(nlevels);
     for (int level = 0; level < nlevels; ++level)
     {
         float scale = mvInvScaleFactor[level];
-        Size sz(cvRound((float)image.cols*scale), cvRound((float)image.rows*scale));
+        Size sz(cvRound((float)imageSize.width*scale), cvRound((float)imageSize.height*scale));
         Size wholeSize(sz.width + EDGE_THRESHOLD*2, sz.height + EDGE_THRESHOLD*2);
-        Mat temp(wholeSize, image.type()), masktemp;
-        mvImagePyramid[level] = temp(Rect(EDGE_THRESHOLD, EDGE_THRESHOLD, sz.width, sz.height));
+        mvPyramidBuffer[level].create(wholeSize, CV_8UC1);
+        mvImagePyramid[level] = mvPyramidBuffer[level](Rect(EDGE_THRESHOLD, EDGE_THRESHOLD, sz.width, sz.height));
+        mvBlurBuffer[level].create(sz, CV_8UC1);
+        mvPatternStep[level] = 0;//the blur buffer may have a new step
+    }
+}
+
+void ORBextractor::ComputeFeaturesPerLevel()
+{
+    mnFeaturesPerLevel.assign(nlevels, 0);
+    float factor = 1.0f / scaleFactor;//default 1/1.2
+    float nDesiredFeaturesPerScale = nfeatures*(1 - factor)/(1 - (float)pow((double)factor, (double)mnActiveLevels));//for the nfeatures is distributed in every level by geometric sequence TF=F0+F0*f+F0*f^2+...
+    //default 217
+
+    int sumFeatures = 0;
+    for( int level = 0; level < mnActiveLevels-1; level++ )
+    {
+        mnFeaturesPerLevel[level] = cvRound(nDesiredFeaturesPerScale);//cvRound use 0.5 to carry over when intpart is odd and truncate it when it's even for 0.000... this special unbalanced probability
+        sumFeatures += mnFeaturesPerLevel[level];
+        nDesiredFeaturesPerScale *= factor;
+    }
+    mnFeaturesPerLevel[mnActiveLevels-1] = std::max(nfeatures - sumFeatures, 0);//for the numerical error
+}
+
+void ORBextractor::SetFeaturesNum(int _nfeatures, int nActiveLevels)
+{
+    nfeatures = std::max(_nfeatures, 1);
+    mnActiveLevels = std::min(std::max(nActiveLevels, 1), nlevels);
+    ComputeFeaturesPerLevel();
+}
+
+void ORBextractor::SetStaticMask(const cv::Mat &mask)
+{
+    assert(mask.empty() || mask.type() == CV_8UC1);
+    mStaticMask = mask.clone();
+    mbMaskPyramidStatic = false;
+}
+
+void ORBextractor::ComputeMaskPyramid(const cv::Mat &mask, const bool bStatic)
+{
+    if (mask.empty())
+    {
+        for (int level = 0; level < nlevels; ++level)
+        {
+            mvMaskPyramid[level].release();
+            mvbLevelMasked[level] = 0;
+        }
+        mbMaskPyramidStatic = false;
+        return;
+    }
+    if (bStatic && mbMaskPyramidStatic && mvMaskPyramid[0].data == mask.data)//the pyramid of the static mask is made once
+        return;
+
+    for (int level = 0; level < nlevels; ++level)
+    {
+        if (level == 0)
+            mvMaskPyramid[0] = mask;//no copy, it's only read during this extraction
+        else
+            resize(mask, mvMaskPyramid[level], mvImagePyramid[level].size(), 0, 0, INTER_NEAREST);
+        mvbLevelMasked[level] = countNonZero(mvMaskPyramid[level]) == 0;
+    }
+    mbMaskPyramidStatic = bStatic;
+}
+
+//BGR/RGB(A) to gray into the preallocated dst, same fixed point formula as cvtColor(yuv_shift=14)
+static void ColorToGray(const Mat& src, Mat& dst, const bool bRGB)
+{
+    const int scn = src.channels();
+    const int bidx = bRGB ? 2 : 0;
+    const int cb = 1868, cg = 9617, cr = 4899, shift = 14;
+#ifdef __SSSE3__
+    //pshufb masks gathering channel c of 16 pixels from the k-th 16 bytes
+    __m128i vShuf[4][3];
+    for (int k = 0; k < scn; ++k)
+        for (int c = 0; c < 3; ++c)
+        {
+            uchar idx[16];
+            for (int p = 0; p < 16; ++p)
+            {
+                const int b = scn * p + c - 16 * k;
+                idx[p] = (b >= 0 && b < 16) ? (uchar)b : 0x80;
+            }
+            vShuf[k][c] = _mm_loadu_si128((const __m128i*)idx);
+        }
+    const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi16(1);
+    const __m128i cbg = _mm_set1_epi32((cg << 16) | cb), crd = _mm_set1_epi32(((1 << (shift-1)) << 16) | cr);
+#endif
+    for (int i = 0; i < src.rows; ++i)
+    {
+        const uchar* s = src.ptr<uchar>(i);
+        uchar* d = dst.ptr<uchar>(i);
+        int j = 0;
+#ifdef __SSSE3__
+        for (; j <= src.cols - 16; j += 16, s += 16 * scn)
+        {
+            __m128i ch[3] = {zero, zero, zero};
+            for (int k = 0; k < scn; ++k)
+            {
+                const __m128i v = _mm_loadu_si128((const __m128i*)(s + 16 * k));
+                for (int c = 0; c < 3; ++c)
+                    ch[c] = _mm_or_si128(ch[c], _mm_shuffle_epi8(v, vShuf[k][c]));
+            }
+            const __m128i b = ch[bidx], g = ch[1], r = ch[2-bidx];
+            __m128i y[4];
+            for (int h = 0; h < 2; ++h)
+            {
+                const __m128i b16 = h ? _mm_unpackhi_epi8(b, zero) : _mm_unpacklo_epi8(b, zero);
+                const __m128i g16 = h ? _mm_unpackhi_epi8(g, zero) : _mm_unpacklo_epi8(g, zero);
+                const __m128i r16 = h ? _mm_unpackhi_epi8(r, zero) : _mm_unpacklo_epi8(r, zero);
+                y[2*h] = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(b16, g16), cbg), _mm_madd_epi16(_mm_unpacklo_epi16(r16, one), crd));
+                y[2*h+1] = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(b16, g16), cbg), _mm_madd_epi16(_mm_unpackhi_epi16(r16, one), crd));
+            }
+            for (int h = 0; h < 4; ++h)
+                y[h] = _mm_srli_epi32(y[h], shift);
+            _mm_storeu_si128((__m128i*)(d + j), _mm_packus_epi16(_mm_packs_epi32(y[0], y[1]), _mm_packs_epi32(y[2], y[3])));
+        }
+#endif
+        for (; j < src.cols; ++j, s += scn)
+            d[j] = (uchar)((s[bidx] * cb + s[1] * cg + s[2-bidx] * cr + (1 << (shift-1))) >> shift);
+    }
+}
+
+void ORBextractor::ComputePyramid(cv::Mat image)
+{
+    if (image.size() != mImageSize)//buffers are only (re)allocated for a new image size
+        AllocatePyramid(image.size());
+
+    for (int level = 0; level < mnActiveLevels; ++level)
+    {
+        Mat &temp = mvPyramidBuffer[level];
 
         // Compute the resized image
         if( level != 0 )
         {
-            resize(mvImagePyramid[level-1], mvImagePyramid[level], sz, 0, 0, INTER_LINEAR);
+            resize(mvImagePyramid[level-1], mvImagePyramid[level], mvImagePyramid[level].size(), 0, 0, INTER_LINEAR);//writes into the ROI of temp
 
             copyMakeBorder(mvImagePyramid[level], temp, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD,
                            BORDER_REFLECT_101+BORDER_ISOLATED);//here 0x04+0x10==0x04|0x10(borderType|BORDER_ISOLATED)
-            //still use extrapolation when the src is ROI(a part of a bigger image),now it's useless
+            //src is the ROI of temp, so only the border is filled in place
         }
-        else
+        else if (image.channels() == 1)
         {
             copyMakeBorder(image, temp, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD,
                            BORDER_REFLECT_101);//BORDER_DEFAULT/use the border pixels as the reflection axis to extrapolate the outside pixels of image
         }
+        else
+        {
+            //1 pass over the color image instead of cvtColor + copyMakeBorder
+            ColorToGray(image, mvImagePyramid[0], mbRGB);
+            copyMakeBorder(mvImagePyramid[0], temp, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD,
+                           BORDER_REFLECT_101+BORDER_ISOLATED);
+        }
     }
 
 }
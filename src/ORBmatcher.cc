@@ -28,6 +28,10 @@
 #include "Thirdparty/DBoW2/DBoW2/FeatureVector.h"
 
 #include<stdint-gcc.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+#include<immintrin.h>
+#define ORBMATCHER_X86_DISPATCH
+#endif
 
 using namespace std;
 
@@ -42,93 +46,161 @@ ORBmatcher::ORBmatcher(float nnratio, bool checkOri): mfNNratio(nnratio), mbChec
 {
 }
 
-int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoints, const float th)//should use F.isInFrustum(pMP,0.5) first, it coarsely judges the scale&&rotation invariance
+int ORBmatcher::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoints, const float th, WorkerPool* pWorkerPool)//should use F.isInFrustum(pMP,0.5) first, it coarsely judges the scale&&rotation invariance
 {
     int nmatches=0;
 
-    const bool bFactor = th!=1.0;
+    const int nMPs = vpMapPoints.size();
+    const int nMinBand = 256;
+    int nBands = pWorkerPool ? min(pWorkerPool->GetThreadsNum()+1,nMPs/nMinBand) : 1;
+    if(nBands<=1)
+    {
+        vector<int> vDists;
+        for(int iMP=0; iMP<nMPs; iMP++)
+        {
+            int bestDist;
+            const int bestIdx = MatchByProjection(F,vpMapPoints[iMP],th,vDists,bestDist);
+            if(bestIdx>=0)
+            {
+                F.mvpMapPoints[bestIdx]=vpMapPoints[iMP];//later MPs won't match this keypoint again
+                nmatches++;
+            }
+        }
+        return nmatches;//this is not all the matches in mCurrentFrame.mvpMapPoints, just the addition part by local map
+    }
 
-    for(size_t iMP=0; iMP<vpMapPoints.size(); iMP++)
+    // Every MapPoint is matched against the keypoints free before this call, in bands of vpMapPoints on the workers
+    vector<int> vBestIdx(nMPs,-1),vBestDist(nMPs,INT_MAX);
+    auto matchBand=[&](const int iBegin, const int iEnd){
+        vector<int> vDists;
+        for(int iMP=iBegin; iMP<iEnd; iMP++)
+            vBestIdx[iMP]=MatchByProjection(F,vpMapPoints[iMP],th,vDists,vBestDist[iMP]);
+    };
+    vector<future<void> > vFutures;
+    for(int b=1; b<nBands; b++)
+        vFutures.push_back(pWorkerPool->Submit(bind(matchBand,nMPs*b/nBands,nMPs*(b+1)/nBands)));
+    matchBand(0,nMPs/nBands);
+    for(size_t i=0; i<vFutures.size(); i++)
+        pWorkerPool->Wait(vFutures[i]);
+
+    // Resolve the keypoints claimed by several MapPoints: the smallest distance wins, then the smaller index in vpMapPoints,
+    // so the result doesn't depend on the number of workers(but it differs from the first-come order of the serial path above)
+    vector<int> vClaimMP(F.N,-1);
+    for(int iMP=0; iMP<nMPs; iMP++)
     {
-        MapPoint* pMP = vpMapPoints[iMP];
-        if(!pMP->mbTrackInView)//false when it's already in mCurrentFrame.mvpMapPoints or this local MapPoint is not in frustum of the mCurrentFrame
+        const int idx=vBestIdx[iMP];
+        if(idx<0)
             continue;
+        if(vClaimMP[idx]<0 || vBestDist[iMP]<vBestDist[vClaimMP[idx]])
+            vClaimMP[idx]=iMP;
+    }
+    for(int idx=0; idx<F.N; idx++)
+    {
+        if(vClaimMP[idx]>=0)
+        {
+            F.mvpMapPoints[idx]=vpMapPoints[vClaimMP[idx]];
+            nmatches++;
+        }
+    }
 
-        if(pMP->isBad())
+    // The losers take their best keypoint still free like in the serial path, they are few so they're rematched serially
+    vector<int> vDists;
+    for(int iMP=0; iMP<nMPs; iMP++)
+    {
+        const int idx=vBestIdx[iMP];
+        if(idx<0 || vClaimMP[idx]==iMP)
             continue;
+        int bestDist;
+        const int bestIdx = MatchByProjection(F,vpMapPoints[iMP],th,vDists,bestDist);//the committed keypoints are skipped now
+        if(bestIdx>=0)
+        {
+            F.mvpMapPoints[bestIdx]=vpMapPoints[iMP];
+            nmatches++;
+        }
+    }
 
-        const int &nPredictedLevel = pMP->mnTrackScaleLevel;
+    return nmatches;
+}
 
-        // The size of the window will depend on the viewing direction
-        float r = RadiusByViewingCos(pMP->mTrackViewCos);
+int ORBmatcher::MatchByProjection(const Frame &F, MapPoint* pMP, const float th, vector<int> &vDists, int &bestDist) const
+{
+    if(!pMP->mbTrackInView)//false when it's already in mCurrentFrame.mvpMapPoints or this local MapPoint is not in frustum of the mCurrentFrame
+        return -1;
 
-        if(bFactor)
-            r*=th;
+    if(pMP->isBad())
+        return -1;
 
-        const vector<size_t> vIndices =
-                F.GetFeaturesInArea(pMP->mTrackProjX,pMP->mTrackProjY,r*F.mvScaleFactors[nPredictedLevel],nPredictedLevel-1,nPredictedLevel);//-1 is for mnTrackScaleLevel uses ceil(), ceil() can also give a larger r'
+    const bool bFactor = th!=1.0;
 
-        if(vIndices.empty())
-            continue;
+    const int &nPredictedLevel = pMP->mnTrackScaleLevel;
 
-        const cv::Mat MPdescriptor = pMP->GetDescriptor();//get the best descriptor of the MP
+    // The size of the window will depend on the viewing direction
+    float r = RadiusByViewingCos(pMP->mTrackViewCos);
 
-        int bestDist=256;
-        int bestLevel= -1;
-        int bestDist2=256;
-        int bestLevel2 = -1;
-        int bestIdx =-1 ;
+    if(bFactor)
+        r*=th;
 
-        // Get best and second matches with near keypoints
-        for(vector<size_t>::const_iterator vit=vIndices.begin(), vend=vIndices.end(); vit!=vend; vit++)
-        {
-            const size_t idx = *vit;
+    const vector<size_t> vIndices =
+            F.GetFeaturesInArea(pMP->mTrackProjX,pMP->mTrackProjY,r*F.mvScaleFactors[nPredictedLevel],nPredictedLevel-1,nPredictedLevel);//-1 is for mnTrackScaleLevel uses ceil(), ceil() can also give a larger r'
 
-            if(F.mvpMapPoints[idx])//if this keypoint has already corresponding MapPoint(by TrackWithMotionModel/TrackReferenceKeyFrame() or by this function)
-                if(F.mvpMapPoints[idx]->Observations()>0)
-                    continue;
+    if(vIndices.empty())
+        return -1;
 
-            if(F.mvuRight[idx]>0)
-            {
-                const float er = fabs(pMP->mTrackProjXR-F.mvuRight[idx]);
-                if(er>r*F.mvScaleFactors[nPredictedLevel])//if right virtual image's error is too large(>r')
-                    continue;
-            }
+    const cv::Mat MPdescriptor = pMP->GetDescriptor();//get the best descriptor of the MP
+    DescriptorDistances(MPdescriptor,F.mDescriptors,vIndices,vDists);
 
-            const cv::Mat &d = F.mDescriptors.row(idx);
+    bestDist=256;
+    int bestLevel= -1;
+    int bestDist2=256;
+    int bestLevel2 = -1;
+    int bestIdx =-1 ;
 
-            const int dist = DescriptorDistance(MPdescriptor,d);
+    // Get best and second matches with near keypoints
+    for(size_t iC=0; iC<vIndices.size(); iC++)
+    {
+        const size_t idx = vIndices[iC];
 
-            if(dist<bestDist)
-            {
-                bestDist2=bestDist;
-                bestDist=dist;
-                bestLevel2 = bestLevel;
-                bestLevel = F.mvKeysUn[idx].octave;
-                bestIdx=idx;
-            }
-            else if(dist<bestDist2)
-            {
-                bestLevel2 = F.mvKeysUn[idx].octave;
-                bestDist2=dist;
-            }
-        }
+        if(F.mvpMapPoints[idx])//if this keypoint has already corresponding MapPoint(by TrackWithMotionModel/TrackReferenceKeyFrame() or by this function)
+            if(F.mvpMapPoints[idx]->Observations()>0)
+                continue;
 
-        // Apply ratio to second match (only if best and second are in the same scale level), there are 2 possible levels
-        if(bestDist<=TH_HIGH)
+        if(F.mvuRight[idx]>0)
         {
-            if(bestLevel==bestLevel2 && bestDist>mfNNratio*bestDist2)//if bestDist/bestDist2 <= threshold then this bestIdx can be matched with this MP
+            const float er = fabs(pMP->mTrackProjXR-F.mvuRight[idx]);
+            if(er>r*F.mvScaleFactors[nPredictedLevel])//if right virtual image's error is too large(>r')
                 continue;
+        }
 
-            F.mvpMapPoints[bestIdx]=pMP;
-            nmatches++;
+        const int dist = vDists[iC];
+
+        if(dist<bestDist)
+        {
+            bestDist2=bestDist;
+            bestDist=dist;
+            bestLevel2 = bestLevel;
+            bestLevel = F.mvKeysUn[idx].octave;
+            bestIdx=idx;
+        }
+        else if(dist<bestDist2)
+        {
+            bestLevel2 = F.mvKeysUn[idx].octave;
+            bestDist2=dist;
         }
     }
 
-    return nmatches;//this is not all the matches in mCurrentFrame.mvpMapPoints, just the addition part by local map
+    // Apply ratio to second match (only if best and second are in the same scale level), there are 2 possible levels
+    if(bestDist<=TH_HIGH)
+    {
+        if(bestLevel==bestLevel2 && bestDist>mfNNratio*bestDist2)//if bestDist/bestDist2 <= threshold then this bestIdx can be matched with this MP
+            return -1;
+
+        return bestIdx;
+    }
+
+    return -1;
 }
 
-float ORBmatcher::RadiusByViewingCos(const float &viewCos)
+float ORBmatcher::RadiusByViewingCos(const float &viewCos) const
 {
     if(viewCos>0.998)//in +- 3.6 degrees, the searching window will be smaller
         return 2.5;
@@ -172,6 +244,7 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
     for(int i=0;i<HISTO_LENGTH;i++)
         rotHist[i].reserve(500);
     const float factor = 1.0f/HISTO_LENGTH;
+    vector<int> vDists;
 
     // We perform the matching over ORB that belong to the same vocabulary node (at a certain level)
     DBoW2::FeatureVector::const_iterator KFit = vFeatVecKF.begin();
@@ -199,6 +272,7 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
                     continue;                
 
                 const cv::Mat &dKF= pKF->mDescriptors.row(realIdxKF);
+                DescriptorDistances(dKF,F.mDescriptors,vIndicesF,vDists);
 
                 int bestDist1=256;
                 int bestIdxF =-1 ;
@@ -211,9 +285,7 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
                     if(vpMapPointMatches[realIdxF])//avoid duplicate matching in this function()
                         continue;
 
-                    const cv::Mat &dF = F.mDescriptors.row(realIdxF);
-
-                    const int dist =  DescriptorDistance(dKF,dF);
+                    const int dist = vDists[iF];
 
                     if(dist<bestDist1)
                     {
@@ -309,6 +381,7 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const vector<MapP
     spAlreadyFound.erase(static_cast<MapPoint*>(NULL));//so need to erase nullptr
 
     int nmatches=0;//additional matches between vpPoints and pKF->mvpMapPoints
+    vector<int> vDists;
 
     // For each Candidate MapPoint Project and Match
     for(int iMP=0, iendMP=vpPoints.size(); iMP<iendMP; iMP++)
@@ -368,12 +441,13 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const vector<MapP
 
         // Match to the most similar keypoint in the radius
         const cv::Mat dMP = pMP->GetDescriptor();
+        DescriptorDistances(dMP,pKF->mDescriptors,vIndices,vDists);
 
         int bestDist = 256;
         int bestIdx = -1;
-        for(vector<size_t>::const_iterator vit=vIndices.begin(), vend=vIndices.end(); vit!=vend; vit++)
+        for(size_t iC=0; iC<vIndices.size(); iC++)
         {
-            const size_t idx = *vit;
+            const size_t idx = vIndices[iC];
             if(vpMatched[idx])//here vpMatched[idx]!=pMP(for !spAlreadyFound.count(pMP)) but if it's not nullptr meaning it/pKF->mvpMapPoints[idx] has already been matched(pMP is not matched)
                 continue;
 
@@ -382,9 +456,7 @@ int ORBmatcher::SearchByProjection(KeyFrame* pKF, cv::Mat Scw, const vector<MapP
             if(kpLevel<nPredictedLevel-1 || kpLevel>nPredictedLevel)//check nPredictedLevel error here not in pKF->GetFeaturesInArea(), same as SearchBySim3(), like SBP(Frame,vec<MP*>)
                 continue;
 
-            const cv::Mat &dKF = pKF->mDescriptors.row(idx);
-
-            const int dist = DescriptorDistance(dMP,dKF);
+            const int dist = vDists[iC];
 
             if(dist<bestDist)
             {
@@ -416,6 +488,7 @@ int ORBmatcher::SearchForInitialization(Frame &F1, Frame &F2, vector<cv::Point2f
 
     vector<int> vMatchedDistance(F2.mvKeysUn.size(),INT_MAX);
     vector<int> vnMatches21(F2.mvKeysUn.size(),-1);
+    vector<int> vDists;
 
     for(size_t i1=0, iend1=F1.mvKeysUn.size(); i1<iend1; i1++)
     {
@@ -430,18 +503,17 @@ int ORBmatcher::SearchForInitialization(Frame &F1, Frame &F2, vector<cv::Point2f
             continue;
 
         cv::Mat d1 = F1.mDescriptors.row(i1);
+        DescriptorDistances(d1,F2.mDescriptors,vIndices2,vDists);
 
         int bestDist = INT_MAX;
         int bestDist2 = INT_MAX;
         int bestIdx2 = -1;
 
-        for(vector<size_t>::iterator vit=vIndices2.begin(); vit!=vIndices2.end(); vit++)
+        for(size_t iC=0; iC<vIndices2.size(); iC++)
         {
-            size_t i2 = *vit;
+            size_t i2 = vIndices2[iC];
 
-            cv::Mat d2 = F2.mDescriptors.row(i2);
-
-            int dist = DescriptorDistance(d1,d2);
+            int dist = vDists[iC];
 
             if(vMatchedDistance[i2]<=dist)
                 continue;
@@ -542,6 +614,7 @@ int ORBmatcher::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
     const float factor = 1.0f/HISTO_LENGTH;
 
     int nmatches = 0;
+    vector<int> vDists;
 
     DBoW2::FeatureVector::const_iterator f1it = vFeatVec1.begin();
     DBoW2::FeatureVector::const_iterator f2it = vFeatVec2.begin();
@@ -563,6 +636,7 @@ int ORBmatcher::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
                     continue;
 
                 const cv::Mat &d1 = Descriptors1.row(idx1);
+                DescriptorDistances(d1,Descriptors2,f2it->second,vDists);
 
                 int bestDist1=256;
                 int bestIdx2 =-1 ;
@@ -580,9 +654,7 @@ int ORBmatcher::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
                     if(pMP2->isBad())
                         continue;
 
-                    const cv::Mat &d2 = Descriptors2.row(idx2);
-
-                    int dist = DescriptorDistance(d1,d2);
+                    int dist = vDists[i2];
 
                     if(dist<bestDist1)
                     {
@@ -683,6 +755,7 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
         rotHist[i].reserve(500);
 
     const float factor = 1.0f/HISTO_LENGTH;
+    vector<int> vDists;
 
     DBoW2::FeatureVector::const_iterator f1it = vFeatVec1.begin();
     DBoW2::FeatureVector::const_iterator f2it = vFeatVec2.begin();
@@ -712,6 +785,7 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
                 const cv::KeyPoint &kp1 = pKF1->mvKeysUn[idx1];
                 
                 const cv::Mat &d1 = pKF1->mDescriptors.row(idx1);
+                DescriptorDistances(d1,pKF2->mDescriptors,f2it->second,vDists);
                 
                 int bestDist = TH_LOW;
                 int bestIdx2 = -1;
@@ -732,9 +806,7 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
                         if(!bStereo2)
                             continue;
                     
-                    const cv::Mat &d2 = pKF2->mDescriptors.row(idx2);
-                    
-                    const int dist = DescriptorDistance(d1,d2);
+                    const int dist = vDists[i2];
                     
                     if(dist>TH_LOW || dist>bestDist)//use hamming distance to match is right for the sparse creation, no need to use patch matching method
                         continue;
@@ -838,6 +910,7 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const
     cv::Mat Ow = pKF->GetCameraCenter();
 
     int nFused=0;
+    vector<int> vDists;
 
     const int nMPs = vpMapPoints.size();
 
@@ -902,12 +975,13 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const
         // Match to the most similar keypoint in the radius
 
         const cv::Mat dMP = pMP->GetDescriptor();
+        DescriptorDistances(dMP,pKF->mDescriptors,vIndices,vDists);
 
         int bestDist = 256;
         int bestIdx = -1;
-        for(vector<size_t>::const_iterator vit=vIndices.begin(), vend=vIndices.end(); vit!=vend; vit++)//inner cycle is rectifying KF's features
+        for(size_t iC=0; iC<vIndices.size(); iC++)//inner cycle is rectifying KF's features
         {
-            const size_t idx = *vit;
+            const size_t idx = vIndices[iC];
 
             const cv::KeyPoint &kp = pKF->mvKeysUn[idx];
 
@@ -943,9 +1017,7 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const
                     continue;
             }
 
-            const cv::Mat &dKF = pKF->mDescriptors.row(idx);
-
-            const int dist = DescriptorDistance(dMP,dKF);
+            const int dist = vDists[iC];
 
             if(dist<bestDist)
             {
@@ -999,6 +1071,7 @@ int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoi
     const set<MapPoint*> spAlreadyFound = pKF->GetMapPoints();
 
     int nFused=0;
+    vector<int> vDists;
 
     const int nPoints = vpPoints.size();
 
@@ -1062,21 +1135,20 @@ int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoi
         // Match to the most similar keypoint in the radius
 
         const cv::Mat dMP = pMP->GetDescriptor();
+        DescriptorDistances(dMP,pKF->mDescriptors,vIndices,vDists);
 
         int bestDist = INT_MAX;//nice
         int bestIdx = -1;
-        for(vector<size_t>::const_iterator vit=vIndices.begin(); vit!=vIndices.end(); vit++)
+        for(size_t iC=0; iC<vIndices.size(); iC++)
         {
-            const size_t idx = *vit;
+            const size_t idx = vIndices[iC];
             const int &kpLevel = pKF->mvKeysUn[idx].octave;
 
 	    //here no vpMatched[idx] for vpReplacePoint is all nullptr at first and it can be rectified to find the best matched one for the idxth feature in pKF
             if(kpLevel<nPredictedLevel-1 || kpLevel>nPredictedLevel)//but check predicted level error here instead of in pKF->GetFeaturesInArea()
                 continue;
 
-            const cv::Mat &dKF = pKF->mDescriptors.row(idx);
-
-            int dist = DescriptorDistance(dMP,dKF);
+            int dist = vDists[iC];
 
             if(dist<bestDist)
             {
@@ -1129,6 +1201,7 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
 
     const vector<MapPoint*> vpMapPoints1 = pKF1->GetMapPointMatches();
     const int N1 = vpMapPoints1.size();
+    vector<int> vDists;
 
     const vector<MapPoint*> vpMapPoints2 = pKF2->GetMapPointMatches();
     const int N2 = vpMapPoints2.size();
@@ -1203,21 +1276,20 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
 
         // Match to the most similar keypoint in the radius
         const cv::Mat dMP = pMP->GetDescriptor();
+        DescriptorDistances(dMP,pKF2->mDescriptors,vIndices,vDists);
 
         int bestDist = INT_MAX;
         int bestIdx = -1;
-        for(vector<size_t>::const_iterator vit=vIndices.begin(), vend=vIndices.end(); vit!=vend; vit++)
+        for(size_t iC=0; iC<vIndices.size(); iC++)
         {
-            const size_t idx = *vit;
+            const size_t idx = vIndices[iC];
 
             const cv::KeyPoint &kp = pKF2->mvKeysUn[idx];
 
             if(kp.octave<nPredictedLevel-1 || kp.octave>nPredictedLevel)//but check the min/maxlevel here instead of GetFeaturesInArea()
                 continue;
 
-            const cv::Mat &dKF = pKF2->mDescriptors.row(idx);
-
-            const int dist = DescriptorDistance(dMP,dKF);
+            const int dist = vDists[iC];
 
             if(dist<bestDist)
             {
@@ -1283,21 +1355,20 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
 
         // Match to the most similar keypoint in the radius
         const cv::Mat dMP = pMP->GetDescriptor();
+        DescriptorDistances(dMP,pKF1->mDescriptors,vIndices,vDists);
 
         int bestDist = INT_MAX;
         int bestIdx = -1;
-        for(vector<size_t>::const_iterator vit=vIndices.begin(), vend=vIndices.end(); vit!=vend; vit++)
+        for(size_t iC=0; iC<vIndices.size(); iC++)
         {
-            const size_t idx = *vit;
+            const size_t idx = vIndices[iC];
 
             const cv::KeyPoint &kp = pKF1->mvKeysUn[idx];
 
             if(kp.octave<nPredictedLevel-1 || kp.octave>nPredictedLevel)//check predicted level error
                 continue;
 
-            const cv::Mat &dKF = pKF1->mDescriptors.row(idx);
-
-            const int dist = DescriptorDistance(dMP,dKF);
+            const int dist = vDists[iC];
 
             if(dist<bestDist)
             {
@@ -1356,6 +1427,7 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
 
     const bool bForward = tlc.at<float>(2)>CurrentFrame.mb && !bMono;//delta z >0.08m
     const bool bBackward = -tlc.at<float>(2)>CurrentFrame.mb && !bMono;//delta z<-0.08m
+    vector<int> vDists;
 
     for(int i=0; i<LastFrame.N; i++)
     {
@@ -1403,13 +1475,14 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
                     continue;
 
                 const cv::Mat dMP = pMP->GetDescriptor();//get the best descriptor for the MapPoint
+                DescriptorDistances(dMP,CurrentFrame.mDescriptors,vIndices2,vDists);
 
                 int bestDist = 256;
                 int bestIdx2 = -1;
 
-                for(vector<size_t>::const_iterator vit=vIndices2.begin(), vend=vIndices2.end(); vit!=vend; vit++)
+                for(size_t iC=0; iC<vIndices2.size(); iC++)
                 {
-                    const size_t i2 = *vit;
+                    const size_t i2 = vIndices2[iC];
                     if(CurrentFrame.mvpMapPoints[i2])//avoid for rectifying same keypoint's MapPoint in CurrentFrame,for theoretically one-to-one match for keypoints in Last&CurrentFrame
                         if(CurrentFrame.mvpMapPoints[i2]->Observations()>0)
                             continue;
@@ -1422,9 +1495,7 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
                             continue;
                     }
 
-                    const cv::Mat &d = CurrentFrame.mDescriptors.row(i2);
-
-                    const int dist = DescriptorDistance(dMP,d);
+                    const int dist = vDists[iC];
 
                     if(dist<bestDist)
                     {
@@ -1494,6 +1565,7 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
     const float factor = 1.0f/HISTO_LENGTH;
 
     const vector<MapPoint*> vpMPs = pKF->GetMapPointMatches();
+    vector<int> vDists;
 
     for(size_t i=0, iend=vpMPs.size(); i<iend; i++)
     {
@@ -1541,19 +1613,18 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
                     continue;
 
                 const cv::Mat dMP = pMP->GetDescriptor();
+                DescriptorDistances(dMP,CurrentFrame.mDescriptors,vIndices2,vDists);
 
                 int bestDist = 256;
                 int bestIdx2 = -1;
 
-                for(vector<size_t>::const_iterator vit=vIndices2.begin(); vit!=vIndices2.end(); vit++)
+                for(size_t iC=0; iC<vIndices2.size(); iC++)
                 {
-                    const size_t i2 = *vit;
+                    const size_t i2 = vIndices2[iC];
                     if(CurrentFrame.mvpMapPoints[i2])//avoid replicate matching
                         continue;
 
-                    const cv::Mat &d = CurrentFrame.mDescriptors.row(i2);
-
-                    const int dist = DescriptorDistance(dMP,d);
+                    const int dist = vDists[iC];
 
                     if(dist<bestDist)
                     {
@@ -1673,4 +1744,135 @@ int ORBmatcher::DescriptorDistance(const cv::Mat &a, const cv::Mat &b)//fastest(
     return dist;
 }
 
+//1-to-N Hamming distance kernels for DescriptorDistances(), all of them give the same results as DescriptorDistance()
+typedef void (*DistancesKernel)(const uint64_t* a, const uchar* const* ppB, const int n, int* dists);
+
+static void DistancesGeneric(const uint64_t* a, const uchar* const* ppB, const int n, int* dists)
+{
+    const uint32_t *pa = (const uint32_t*)a;
+    for(int i=0; i<n; i++)
+    {
+        const uint32_t *pb = (const uint32_t*)ppB[i];
+        int dist=0;
+        for(int k=0; k<8; k++)
+        {
+            uint32_t v = pa[k] ^ pb[k];
+            v = v - ((v >> 1) & 0x55555555);
+            v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+            dist += (((v + (v >> 4)) & 0xF0F0F0F) * 0x1010101) >> 24;
+        }
+        dists[i]=dist;
+    }
+}
+
+#ifdef ORBMATCHER_X86_DISPATCH
+__attribute__((target("popcnt")))
+static void DistancesPOPCNT(const uint64_t* a, const uchar* const* ppB, const int n, int* dists)
+{
+    const uint64_t a0=a[0],a1=a[1],a2=a[2],a3=a[3];
+    for(int i=0; i<n; i++)
+    {
+        const uint64_t *pb = (const uint64_t*)ppB[i];
+        dists[i] = __builtin_popcountll(a0^pb[0])+__builtin_popcountll(a1^pb[1])+
+                   __builtin_popcountll(a2^pb[2])+__builtin_popcountll(a3^pb[3]);
+    }
+}
+
+//byte popcounts by the nibble lookup(pshufb), summed by psadbw into the 4 64bit lanes(each <=64)
+__attribute__((target("avx2,popcnt")))
+static inline __m256i PopcntLanesAVX2(const __m256i x)
+{
+    const __m256i lut = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4, 0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    const __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut,_mm256_and_si256(x,low)),
+                                         _mm256_shuffle_epi8(lut,_mm256_and_si256(_mm256_srli_epi16(x,4),low)));
+    return _mm256_sad_epu8(cnt,_mm256_setzero_si256());
+}
+
+//sums the 4 64bit lanes, 4 distances packed in 16bit fields come out as one 64bit word
+__attribute__((target("avx2,popcnt")))
+static inline uint64_t SumLanesAVX2(const __m256i v)
+{
+    const __m128i h = _mm_add_epi64(_mm256_castsi256_si128(v),_mm256_extracti128_si256(v,1));
+    return (uint64_t)_mm_cvtsi128_si64(h)+(uint64_t)_mm_extract_epi64(h,1);
+}
+
+__attribute__((target("avx2,popcnt")))
+static void DistancesAVX2(const uint64_t* a, const uchar* const* ppB, const int n, int* dists)
+{
+    const __m256i va = _mm256_loadu_si256((const __m256i*)a);
+    int i=0;
+    for(; i+4<=n; i+=4)//4 candidates share one horizontal reduction
+    {
+        const __m256i c0 = PopcntLanesAVX2(_mm256_xor_si256(va,_mm256_loadu_si256((const __m256i*)ppB[i])));
+        const __m256i c1 = PopcntLanesAVX2(_mm256_xor_si256(va,_mm256_loadu_si256((const __m256i*)ppB[i+1])));
+        const __m256i c2 = PopcntLanesAVX2(_mm256_xor_si256(va,_mm256_loadu_si256((const __m256i*)ppB[i+2])));
+        const __m256i c3 = PopcntLanesAVX2(_mm256_xor_si256(va,_mm256_loadu_si256((const __m256i*)ppB[i+3])));
+        const __m256i packed = _mm256_or_si256(_mm256_or_si256(c0,_mm256_slli_epi64(c1,16)),
+                                               _mm256_or_si256(_mm256_slli_epi64(c2,32),_mm256_slli_epi64(c3,48)));
+        const uint64_t sums = SumLanesAVX2(packed);
+        dists[i] = sums&0xffff;
+        dists[i+1] = (sums>>16)&0xffff;
+        dists[i+2] = (sums>>32)&0xffff;
+        dists[i+3] = sums>>48;
+    }
+    if(i<n)
+        DistancesPOPCNT(a,ppB+i,n-i,dists+i);
+}
+
+//GCC's avx512 intrinsics(broadcast/insert/shift...) pass _mm512_undefined_epi32() as the unused merge source, so -O3 reports it
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f,avx512vpopcntdq,avx2,popcnt")))
+static void DistancesAVX512(const uint64_t* a, const uchar* const* ppB, const int n, int* dists)
+{
+    const __m512i va = _mm512_broadcast_i64x4(_mm256_loadu_si256((const __m256i*)a));
+    int i=0;
+    for(; i+8<=n; i+=8)//2 candidates per register, 8 candidates share the reductions
+    {
+        __m512i c[4];
+        for(int k=0; k<4; k++)
+        {
+            const __m512i b = _mm512_inserti64x4(_mm512_castsi256_si512(_mm256_loadu_si256((const __m256i*)ppB[i+2*k])),
+                                                 _mm256_loadu_si256((const __m256i*)ppB[i+2*k+1]),1);
+            c[k] = _mm512_popcnt_epi64(_mm512_xor_si512(va,b));
+        }
+        //lanes 0~3 hold the candidates i,i+2,i+4,i+6 in their 16bit fields, lanes 4~7 hold i+1,i+3,i+5,i+7
+        const __m512i packed = _mm512_or_si512(_mm512_or_si512(c[0],_mm512_slli_epi64(c[1],16)),
+                                               _mm512_or_si512(_mm512_slli_epi64(c[2],32),_mm512_slli_epi64(c[3],48)));
+        const uint64_t sumsEven = SumLanesAVX2(_mm512_castsi512_si256(packed));
+        const uint64_t sumsOdd = SumLanesAVX2(_mm512_extracti64x4_epi64(packed,1));
+        for(int k=0; k<4; k++)
+        {
+            dists[i+2*k] = (sumsEven>>(16*k))&0xffff;
+            dists[i+2*k+1] = (sumsOdd>>(16*k))&0xffff;
+        }
+    }
+    if(i<n)
+        DistancesAVX2(a,ppB+i,n-i,dists+i);
+}
+#pragma GCC diagnostic pop
+#endif
+
+static DistancesKernel SelectDistancesKernel()
+{
+#ifdef ORBMATCHER_X86_DISPATCH
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq"))
+        return DistancesAVX512;
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+        return DistancesAVX2;
+    if(__builtin_cpu_supports("popcnt"))
+        return DistancesPOPCNT;
+#endif
+    return DistancesGeneric;
+}
+
+void ORBmatcher::DescriptorDistances(const cv::Mat &a, const uchar* const* ppB, const int n, int* dists)
+{
+    static const DistancesKernel kernel = SelectDistancesKernel();//chosen once for this CPU
+    kernel(a.ptr<uint64_t>(),ppB,n,dists);
+}
+
 } //namespace ORB_SLAM
@@ -359,7 +359,7 @@ bool IMUInitialization::TryInitVIO(void){//now it's the version cannot allow the
       for(vector<MapPoint*>::iterator vit=vpMPs.begin(), vend=vpMPs.end(); vit!=vend; ++vit) (*vit)->UpdateScale(scale);
       //Now every thing in Map is right scaled & mGravityVec is got
       if (!mbUsePureVision) SetVINSInited(true);
-      mpMap->InformNewChange();//used to notice Tracking thread bMapUpdated
+      mpMap->InformNewScale(scale);//used to notice Tracking thread bMapUpdated && to rescale the Frame tracked during the scale update
       
       mpLocalMapper->Release();//recover LocalMapping thread, same as CorrectLoop()
       std::cout<<std::endl<<"... Map scale & NavState updated ..."<<std::endl<<std::endl;
@@ -18,6 +18,8 @@
 
 //for typedef listEncData
 #include <list>
+#include <deque>
+#include <algorithm>
 
 namespace ORB_SLAM2{
 
@@ -87,6 +89,7 @@ public:
   static Matrix3d mSigmaI;// Sigma etawi of quaternionIMU(qIMU), I/i means Inertial here
   Quaterniond quat;//quaternion of IMUData added
 
+  IMUDataDerived(){}//invalid one like IMUDataBase(), for the preallocated OdomRing
   IMUDataDerived(const double* pdata,const double &tm):quat(pdata){mtm=tm;quat.normalize();}//pdata 4*1: qxyzw
   static void SetParam(const Matrix3d &sigmai,const double sigma2[4],double dmultiplyG=1.0){mSigmaI=sigmai;IMUDataBase::SetParam(sigma2,dmultiplyG);}//gd,ad,bgd,bad, rewrite for virtual so it's not reload
   Matrix3d getJacoright();
@@ -147,6 +150,61 @@ public:
 
 #define listeig(EncData) std::list<EncData,Eigen::aligned_allocator<EncData> >
 
+//time-ordered listeig with a random-access time index, for the O(logn) nearest/range lookups of Tracking::iterijFind();
+//its iterators are the listeig ones, so they can still be passed to the PreIntegration of Frame/KeyFrame;
+//the list is a private base and only the operations keeping mdIndex in sync are exported
+template<class _OdomData>
+class OdomStore:private listeig(_OdomData){
+  typedef listeig(_OdomData) Base;
+  struct IndexItem{
+    double mtm;
+    typename Base::const_iterator iter;
+  };
+  std::deque<IndexItem> mdIndex;//same order as the list, sorted by mtm
+  static bool lessTm(const IndexItem &item,const double &tm){return item.mtm<tm;}
+  static bool greaterTm(const double &tm,const IndexItem &item){return tm<item.mtm;}
+public:
+  typedef typename Base::const_iterator const_iterator;
+
+  const_iterator begin() const{return Base::begin();}
+  const_iterator end() const{return Base::end();}
+  const _OdomData& back() const{return Base::back();}
+  bool empty() const{return Base::empty();}
+  size_t size() const{return Base::size();}
+
+  //false if data is older than back()(out of time order), then it's dropped to keep mdIndex sorted
+  bool push_back(const _OdomData &data){
+    if (!mdIndex.empty()&&data.mtm<mdIndex.back().mtm) return false;
+    Base::push_back(data);
+    IndexItem item={data.mtm,--Base::end()};
+    mdIndex.push_back(item);
+    return true;
+  }
+  const_iterator erase(const_iterator first,const_iterator last){
+    mdIndex.erase(mdIndex.begin()+Position(first),mdIndex.begin()+Position(last));
+    return Base::erase(first,last);
+  }
+  void clear(){mdIndex.clear();Base::clear();}
+
+  //position of iter in the list, size() for end()
+  size_t Position(const_iterator iter) const{
+    if (iter==Base::end()) return mdIndex.size();
+    size_t pos=std::lower_bound(mdIndex.begin(),mdIndex.end(),iter->mtm,lessTm)-mdIndex.begin();
+    while (pos<mdIndex.size()&&mdIndex[pos].iter!=iter) ++pos;//only the data with the same tm are walked
+    assert(pos<mdIndex.size());//iter must be in this store
+    return pos;
+  }
+  const_iterator At(size_t pos) const{return pos<mdIndex.size()?mdIndex[pos].iter:Base::end();}
+  double TimeAt(size_t pos) const{return mdIndex[pos].mtm;}
+  //first position in [posBegin,posEnd) with tm>=curTime(LowerBound)/tm>curTime(UpperBound), posEnd if none
+  size_t LowerBound(const double &curTime,size_t posBegin,size_t posEnd) const{
+    return std::lower_bound(mdIndex.begin()+posBegin,mdIndex.begin()+posEnd,curTime,lessTm)-mdIndex.begin();
+  }
+  size_t UpperBound(const double &curTime,size_t posBegin,size_t posEnd) const{
+    return std::upper_bound(mdIndex.begin()+posBegin,mdIndex.begin()+posEnd,curTime,greaterTm)-mdIndex.begin();
+  }
+};
+
 }
     
 #endif
\ No newline at end of file
@@ -0,0 +1,79 @@
+//created by zzh
+#ifndef ODOMRING_H
+#define ODOMRING_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cassert>
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+
+namespace ORB_SLAM2{
+
+//fixed-capacity single-producer/single-consumer ring of Odom(Enc/IMU) data: the producer(CacheOdom()) neither locks nor allocates,
+//the consumer moves the data into the listeig store used by PreIntegration by Drain(); the consumer role can be taken by
+//any thread holding the consumer's mutex(Tracking::mMutexOdom); the producer must be one thread, which is checked by assert
+template<class _OdomData>
+class OdomRing{
+  static const size_t kCacheLine=64;
+public:
+  explicit OdomRing(size_t capacity=1024):mnHead(0),mdNewestTime(-1),mProducerId(std::thread::id()),mnTail(0){
+    size_t n=1;
+    while (n<capacity) n<<=1;//power of 2 for the mask
+    mvData.resize(n);
+    mnMask=n-1;
+  }
+
+  //producer only, false when full(the data isn't pushed)
+  bool Push(const _OdomData &data){
+    CheckProducer();
+    const size_t head=mnHead.load(std::memory_order_relaxed);
+    if (head-mnTail.load(std::memory_order_acquire)>mnMask) return false;
+    mvData[head&mnMask]=data;
+    mnHead.store(head+1,std::memory_order_release);
+    mdNewestTime.store(data.mtm,std::memory_order_seq_cst);//seq_cst for the waiting check of Tracking::CacheOdom()
+    return true;
+  }
+  //consumer only, appends all the pushed data to l in order, returns the number of them
+  template<class _Container>
+  size_t Drain(_Container &l){
+    const size_t tail=mnTail.load(std::memory_order_relaxed);
+    const size_t head=mnHead.load(std::memory_order_acquire);
+    for (size_t i=tail;i!=head;++i) l.push_back(mvData[i&mnMask]);
+    mnTail.store(head,std::memory_order_release);
+    return head-tail;
+  }
+  //any thread, timestamp of the newest pushed data(drained or not), -1 when nothing is pushed
+  double NewestTime() const{return mdNewestTime.load(std::memory_order_seq_cst);}
+
+private:
+  OdomRing(const OdomRing&);//noncopyable
+  OdomRing& operator=(const OdomRing&);
+
+  //the 1st pushing thread becomes the producer, another one racing on mnHead/mvData is a misuse of TrackOdom()
+  void CheckProducer(){
+#ifndef NDEBUG
+    const std::thread::id id=std::this_thread::get_id();
+    std::thread::id owner=mProducerId.load(std::memory_order_relaxed);
+    if (owner==id) return;
+    if (owner==std::thread::id()&&mProducerId.compare_exchange_strong(owner,id)) return;
+    assert(owner==id&&"OdomRing: more than one producer thread");
+#endif
+  }
+
+  std::vector<_OdomData,Eigen::aligned_allocator<_OdomData> > mvData;
+  size_t mnMask;
+  //head/tail on different cache lines, padded instead of alignas for the owner(Tracking) is only aligned by Eigen's operator new
+  char mPad0[kCacheLine];
+  std::atomic<size_t> mnHead;//written by the producer
+  std::atomic<double> mdNewestTime;
+  std::atomic<std::thread::id> mProducerId;//for CheckProducer()
+  char mPad1[kCacheLine];
+  std::atomic<size_t> mnTail;//written by the consumer
+  char mPad2[kCacheLine];
+};
+
+}
+
+#endif
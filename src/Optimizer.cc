@@ -73,7 +73,7 @@ void Optimizer::PoseOptimizationAddEdge<Frame>(Frame* pFrame,vector<g2o::EdgeNav
 	    e->setRobustKernel(rk);
 	    rk->setDelta(deltaMono);
 
-	    e->SetParams(pFrame->fx,pFrame->fy,pFrame->cx,pFrame->cy,Rcb,tcb,Converter::toVector3d(pMP->GetWorldPos()));
+	    e->SetParams(pFrame->fx,pFrame->fy,pFrame->cx,pFrame->cy,Rcb,tcb,Converter::toVector3d(pMP->GetWorldPosTrack()));
 
 	    optimizer.addEdge(e);
 
@@ -1143,7 +1143,7 @@ int Optimizer::PoseOptimization(Frame *pFrame,Frame* pLastF)
                 e->fy = pFrame->fy;
                 e->cx = pFrame->cx;
                 e->cy = pFrame->cy;
-                cv::Mat Xw = pMP->GetWorldPos();
+                cv::Mat Xw = pMP->GetWorldPosTrack();
                 e->Xw[0] = Xw.at<float>(0);
                 e->Xw[1] = Xw.at<float>(1);
                 e->Xw[2] = Xw.at<float>(2);
@@ -1181,7 +1181,7 @@ int Optimizer::PoseOptimization(Frame *pFrame,Frame* pLastF)
                 e->cx = pFrame->cx;
                 e->cy = pFrame->cy;
                 e->bf = pFrame->mbf;
-                cv::Mat Xw = pMP->GetWorldPos();//edge/measurement formula parameter Xw
+                cv::Mat Xw = pMP->GetWorldPosTrack();//edge/measurement formula parameter Xw
                 e->Xw[0] = Xw.at<float>(0);
                 e->Xw[1] = Xw.at<float>(1);
                 e->Xw[2] = Xw.at<float>(2);
@@ -2020,6 +2020,7 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
         pMP->UpdateNormalAndDepth();//update MP's normal for its position changed
     }
     //don't call pMap->InformNewChange(); for it's done outside
+    pMap->InformPoseJump();//but Tracking must know it before mMutexMapUpdate is released
     cout<<"PoseGraph end!"<<endl;
 }
 
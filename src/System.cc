@@ -638,9 +638,12 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     mpLocalMapper->SetIMUInitiator(mpIMUInitiator);
     mpLoopCloser->SetIMUInitiator(mpIMUInitiator);
     mpIMUInitiator->SetLocalMapper(mpLocalMapper);//for Stop LocalMapping thread&&NeedNewKeyFrame() in Tracking thread
+
+    //optional pipelined tracking thread, launched after all the pointers between threads are set
+    mptTracking = mpTracker->GetPipelineDepth()>0?new thread(&ORB_SLAM2::System::RunTracking,this):static_cast<thread*>(NULL);
 }
 
-cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp)
+cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp, const cv::Mat &mask)
 {
     if(mSensor!=STEREO)
     {
@@ -648,50 +651,18 @@ cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const
         exit(-1);
     }   
 
-    // Check mode change
-    {
-        unique_lock<mutex> lock(mMutexMode);
-        if(mbActivateLocalizationMode)
-        {
-            mpLocalMapper->RequestStop();
-
-            // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
-
-            mpTracker->InformOnlyTracking(true);
-            mbActivateLocalizationMode = false;
-        }
-        if(mbDeactivateLocalizationMode)
-        {
-            mpTracker->InformOnlyTracking(false);
-            mpLocalMapper->Release();
-            mbDeactivateLocalizationMode = false;
-        }
-    }
+    if(mptTracking)//pipelined, no overlap for the synchronous call
+        return TrackStereoAsync(imLeft,imRight,timestamp,mask).get();
 
-    // Check reset
-    {
-    unique_lock<mutex> lock(mMutexReset);
-    if(mbReset)
-    {
-        mpTracker->Reset();
-        mbReset = false;
-    }
-    }
+    CheckModeAndReset();
 
-    cv::Mat Tcw = mpTracker->GrabImageStereo(imLeft,imRight,timestamp);
+    cv::Mat Tcw = mpTracker->GrabImageStereo(imLeft,imRight,timestamp,mask);
 
-    unique_lock<mutex> lock2(mMutexState);
-    mTrackingState = mpTracker->mState;
-    mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
-    mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
+    UpdateTrackingState();
     return Tcw;
 }
 
-cv::Mat System::TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp)
+cv::Mat System::TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp, const cv::Mat &mask)
 {
     if(mSensor!=RGBD)
     {
@@ -699,61 +670,114 @@ cv::Mat System::TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const doub
         exit(-1);
     }    
 
-    // Check mode change
-    {
-        unique_lock<mutex> lock(mMutexMode);
-        if(mbActivateLocalizationMode)
-        {
-            mpLocalMapper->RequestStop();
+    if(mptTracking)//pipelined, no overlap for the synchronous call
+        return TrackRGBDAsync(im,depthmap,timestamp,mask).get();
 
-            // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
+    CheckModeAndReset();
+    
+    //important tracking function!
+    cv::Mat Tcw = mpTracker->GrabImageRGBD(im,depthmap,timestamp,mask);
 
-            mpTracker->InformOnlyTracking(true);
-            mbActivateLocalizationMode = false;
-        }
-        if(mbDeactivateLocalizationMode)
-        {
-            mpTracker->InformOnlyTracking(false);
-            mpLocalMapper->Release();
-            mbDeactivateLocalizationMode = false;
-        }
+    UpdateTrackingState();
+    return Tcw;
+}
+
+cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp, const cv::Mat &mask)
+{
+    if(mSensor!=MONOCULAR)
+    {
+        cerr << "ERROR: you called TrackMonocular but input sensor was not set to Monocular." << endl;
+        exit(-1);
     }
 
-    // Check reset
+    if(mptTracking)//pipelined, no overlap for the synchronous call
+        return TrackMonocularAsync(im,timestamp,mask).get();
+
+    CheckModeAndReset();
+
+    cv::Mat Tcw = mpTracker->GrabImageMonocular(im,timestamp,mask);
+
+    UpdateTrackingState();
+
+    return Tcw;
+}
+
+future<cv::Mat> System::TrackStereoAsync(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp, const cv::Mat &mask)
+{
+    if(!mptTracking)
     {
-    unique_lock<mutex> lock(mMutexReset);
-    if(mbReset)
+        promise<cv::Mat> pose;
+        pose.set_value(TrackStereo(imLeft,imRight,timestamp,mask));
+        return pose.get_future();
+    }
+    if(mSensor!=STEREO)
     {
-        mpTracker->Reset();
-        mbReset = false;
+        cerr << "ERROR: you called TrackStereoAsync but input sensor was not set to STEREO." << endl;
+        exit(-1);
     }
+
+    CheckModeAndReset();
+
+    return mpTracker->GrabImageStereoAsync(imLeft,imRight,timestamp,mask);
+}
+
+future<cv::Mat> System::TrackRGBDAsync(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp, const cv::Mat &mask)
+{
+    if(!mptTracking)
+    {
+        promise<cv::Mat> pose;
+        pose.set_value(TrackRGBD(im,depthmap,timestamp,mask));
+        return pose.get_future();
+    }
+    if(mSensor!=RGBD)
+    {
+        cerr << "ERROR: you called TrackRGBDAsync but input sensor was not set to RGBD." << endl;
+        exit(-1);
     }
-    
-    //important tracking function!
-    cv::Mat Tcw = mpTracker->GrabImageRGBD(im,depthmap,timestamp);
 
-    unique_lock<mutex> lock2(mMutexState);
-    mTrackingState = mpTracker->mState;
-    mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
-    mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
-    return Tcw;
+    CheckModeAndReset();
+
+    return mpTracker->GrabImageRGBDAsync(im,depthmap,timestamp,mask);
 }
 
-cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp)
+future<cv::Mat> System::TrackMonocularAsync(const cv::Mat &im, const double &timestamp, const cv::Mat &mask)
 {
+    if(!mptTracking)
+    {
+        promise<cv::Mat> pose;
+        pose.set_value(TrackMonocular(im,timestamp,mask));
+        return pose.get_future();
+    }
     if(mSensor!=MONOCULAR)
     {
-        cerr << "ERROR: you called TrackMonocular but input sensor was not set to Monocular." << endl;
+        cerr << "ERROR: you called TrackMonocularAsync but input sensor was not set to Monocular." << endl;
         exit(-1);
     }
 
+    CheckModeAndReset();
+
+    return mpTracker->GrabImageMonocularAsync(im,timestamp,mask);
+}
+
+void System::RunTracking()
+{
+    promise<cv::Mat> pose;
+    cv::Mat Tcw;
+    while(mpTracker->TrackPipelineFrame(pose,Tcw))
+    {
+        UpdateTrackingState();
+        pose.set_value(Tcw);//GetTrackingState() is already updated when the future is ready
+        mpTracker->SetPipelineIdle();
+    }
+}
+
+void System::CheckModeAndReset()
+{
     // Check mode change
     {
         unique_lock<mutex> lock(mMutexMode);
+        if(mptTracking && (mbActivateLocalizationMode || mbDeactivateLocalizationMode))
+            mpTracker->WaitPipelineIdle();//the queued frames are tracked in the former mode
         if(mbActivateLocalizationMode)
         {
             mpLocalMapper->RequestStop();
@@ -780,19 +804,20 @@ cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp)
     unique_lock<mutex> lock(mMutexReset);
     if(mbReset)
     {
+        if(mptTracking)
+            mpTracker->WaitPipelineIdle();//Reset() can't run with Track()
         mpTracker->Reset();
         mbReset = false;
     }
     }
+}
 
-    cv::Mat Tcw = mpTracker->GrabImageMonocular(im,timestamp);
-
-    unique_lock<mutex> lock2(mMutexState);
+void System::UpdateTrackingState()
+{
+    unique_lock<mutex> lock(mMutexState);
     mTrackingState = mpTracker->mState;
     mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
     mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
-
-    return Tcw;
 }
 
 void System::ActivateLocalizationMode()
@@ -828,6 +853,11 @@ void System::Reset()
 
 void System::Shutdown()
 {
+    if(mptTracking && mptTracking->joinable())
+    {
+        mpTracker->FinishPipeline();//the queued frames are tracked first
+        mptTracking->join();
+    }
     mpIMUInitiator->SetFinishRequest(true);//zzh
     mpLocalMapper->RequestFinish();
     mpLoopCloser->RequestFinish();
@@ -22,6 +22,8 @@
 
 #include<opencv2/core/core.hpp>
 #include<opencv2/features2d/features2d.hpp>
+#include<opencv2/highgui/highgui.hpp>
+#include<opencv2/video/tracking.hpp>
 
 #include"ORBmatcher.h"
 #include"FrameDrawer.h"
@@ -43,22 +45,13 @@ namespace ORB_SLAM2
   
 cv::Mat Tracking::CacheOdom(const double &timestamp, const double* odomdata, const char mode){//different thread from GrabImageX
   //you can add some odometry here for fast Tcw retrieve(e.g. 200Hz)
-  unique_lock<mutex> lock(mMutexOdom);
   switch (mode){
     case System::ENCODER://only encoder
-      if (mlOdomEnc.empty()){
-	mlOdomEnc.push_back(EncData(odomdata,timestamp+mDelayToEnc));//notice Timg=Todom+delay
-	miterLastEnc=mlOdomEnc.begin();
-      }else
-	mlOdomEnc.push_back(EncData(odomdata,timestamp+mDelayToEnc));
+      PushOdom(mRingEnc,EncData(odomdata,timestamp+mDelayToEnc));//notice Timg=Todom+delay
       mpIMUInitiator->SetSensorEnc(true);
       break;
     case System::IMU://only q/awIMU
-      if (mlOdomIMU.empty()){
-	mlOdomIMU.push_back(IMUData(odomdata,timestamp+mDelayToIMU));
-	miterLastIMU=mlOdomIMU.begin();
-      }else
-	mlOdomIMU.push_back(IMUData(odomdata,timestamp+mDelayToIMU));
+      PushOdom(mRingIMU,IMUData(odomdata,timestamp+mDelayToIMU));
 #ifndef TRACK_WITH_IMU
       ;//mbSensorIMU=false;
 #else
@@ -66,16 +59,8 @@ cv::Mat Tracking::CacheOdom(const double &timestamp, const double* odomdata, con
 #endif
       break;
     case System::BOTH://both encoder & q/awIMU
-      if (mlOdomEnc.empty()){
-	mlOdomEnc.push_back(EncData(odomdata,timestamp+mDelayToEnc));
-	miterLastEnc=mlOdomEnc.begin();
-      }else
-	mlOdomEnc.push_back(EncData(odomdata,timestamp+mDelayToEnc));
-      if (mlOdomIMU.empty()){
-	mlOdomIMU.push_back(IMUData(odomdata+2,timestamp+mDelayToIMU));
-	miterLastIMU=mlOdomIMU.begin();
-      }else
-	mlOdomIMU.push_back(IMUData(odomdata+2,timestamp+mDelayToIMU));
+      PushOdom(mRingEnc,EncData(odomdata,timestamp+mDelayToEnc));
+      PushOdom(mRingIMU,IMUData(odomdata+2,timestamp+mDelayToIMU));
       mpIMUInitiator->SetSensorEnc(true);
 #ifndef TRACK_WITH_IMU
       ;//mbSensorIMU=false;
@@ -84,12 +69,53 @@ cv::Mat Tracking::CacheOdom(const double &timestamp, const double* odomdata, con
 #endif
       break;
   }
+  if (mbOdomWaiting){//Track() may be waiting for this data, the empty critical section avoids a lost wakeup
+    {unique_lock<mutex> lock(mMutexOdomWait);}
+    mCondOdom.notify_all();
+  }
   
   return cv::Mat();
 }
+template<class _OdomData>
+void Tracking::PushOdom(OdomRing<_OdomData> &ring,const _OdomData &data){
+  if (ring.Push(data)) return;
+  //full: the Tracking thread hasn't drained it for a long time, so this thread takes the consumer role
+  unique_lock<mutex> lock(mMutexOdom);
+  DrainOdom();
+  bool bPushed=ring.Push(data);//ring is empty now for this thread is its only producer
+  assert(bPushed);
+}
+void Tracking::TrimOdom(){
+  double tmKeep;
+  if (mState==NOT_INITIALIZED){
+    tmKeep=(mSensor==System::MONOCULAR&&mpInitializer)?mInitialFrame.mTimeStamp:mCurrentFrame.mTimeStamp;
+  }else if ((mState==OK||mState==LOST||mState==ODOMOK)&&mpLastKeyFrame){
+    tmKeep=mpLastKeyFrame->mTimeStamp;
+    if (!mv20pFramesReloc.empty()&&mv20pFramesReloc.front()->mTimeStamp<tmKeep) tmKeep=mv20pFramesReloc.front()->mTimeStamp;
+  }else//NO_IMAGES_YET/MAP_REUSE(_RELOC), PreIntegration() culls them later
+    return;
+  TrimOdomStore<EncData>(mlOdomEnc,miterLastEnc,tmKeep);
+  TrimOdomStore<IMUData>(mlOdomIMU,miterLastIMU,tmKeep);
+}
+template<class _OdomData>
+void Tracking::TrimOdomStore(OdomStore<_OdomData> &lOdom,typename listeig(_OdomData)::const_iterator &iterLast,const double &tmKeep){
+  if (lOdom.empty()) return;
+  size_t pos=lOdom.LowerBound(tmKeep-mdErrIMUImg,0,lOdom.size());
+  if (pos>0) --pos;//keep the last one before like PreIntegration(0/2), iterijFind() may choose it
+  size_t posLast=lOdom.Position(iterLast);//iterLast and the one before it are still searched by PreIntegration(1)
+  if (posLast==0) return;
+  if (pos>posLast-1) pos=posLast-1;
+  if (pos>0) lOdom.erase(lOdom.begin(),lOdom.At(pos));
+}
+void Tracking::DrainOdom(){
+  bool bEmpty=mlOdomEnc.empty();
+  if (mRingEnc.Drain(mlOdomEnc)&&bEmpty) miterLastEnc=mlOdomEnc.begin();//miterLastEnc may be end() when the list is empty
+  bEmpty=mlOdomIMU.empty();
+  if (mRingIMU.Drain(mlOdomIMU)&&bEmpty) miterLastIMU=mlOdomIMU.begin();
+}
 
 void Tracking::TrackWithOnlyOdom(bool bMapUpdated){
-  if (!mpIMUInitiator->GetVINSInited()){//VEO, we use mVelocity as EncPreIntegrator from LastFrame if EncPreIntegrator exists
+  if (!mbVINSInitedTrack){//VEO, we use mVelocity as EncPreIntegrator from LastFrame if EncPreIntegrator exists
     assert(!mVelocity.empty());
     cv::Mat Tcw=mVelocity*mLastFrame.mTcw;//To avoid accumulated numerical error of pure encoder predictions causing Rcw is not Unit Lie Group (|Rcw|=1)!!!
     Matrix3d eigRcw=Converter::toMatrix3d(Tcw.rowRange(0,3).colRange(0,3));
@@ -150,6 +176,7 @@ void Tracking::TrackWithOnlyOdom(bool bMapUpdated){
 
 void Tracking::PreIntegration(const char type){
   unique_lock<mutex> lock(mMutexOdom);
+  DrainOdom();
   cout<<"type="<<(int)type<<"...";
   PreIntegration<EncData>(type,mlOdomEnc,miterLastEnc);
 //   cout<<"!"<<mlOdomIMU.size()<<endl;
@@ -208,6 +235,7 @@ bool Tracking::GetVelocityByEnc(bool bMapUpdated){
 //   }
   {
     unique_lock<mutex> lock(mMutexOdom);
+    DrainOdom();
     PreIntegration<EncData>(type,mlOdomEnc,miterLastEnc);
   }
   if (mCurrentFrame.mOdomPreIntEnc.mdeltatij==0){
@@ -254,13 +282,20 @@ bool Tracking::TrackWithIMU(bool bMapUpdated){
         th=15;
     else
         th=7;
-    int nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,th,mSensor==System::MONOCULAR);//has CurrentFrame.mvpMapPoints[bestIdx2]=pMP; in this func. then it can use m-o BA
-
-    // If few matches, uses a wider window search
+    int nmatches = 0;
+    if(mCurrentFrame.mbKLT)//the optical flow already gives the correspondences with mLastFrame
+        nmatches = KLTMatchesWithLastFrame();
     if(nmatches<20)
     {
-        fill(mCurrentFrame.mvpMapPoints.begin(),mCurrentFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));//it's important for SBP() will not rectify the alreay nice CurretFrame.mvpMapPoints
-        nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,2*th,mSensor==System::MONOCULAR);
+        fill(mCurrentFrame.mvpMapPoints.begin(),mCurrentFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
+        nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,th,mSensor==System::MONOCULAR);//has CurrentFrame.mvpMapPoints[bestIdx2]=pMP; in this func. then it can use m-o BA
+
+        // If few matches, uses a wider window search
+        if(nmatches<20)
+        {
+            fill(mCurrentFrame.mvpMapPoints.begin(),mCurrentFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));//it's important for SBP() will not rectify the alreay nice CurretFrame.mvpMapPoints
+            nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,2*th,mSensor==System::MONOCULAR);
+        }
     }
 
     if(nmatches<10)//20)//changed by JingWang
@@ -442,6 +477,7 @@ void Tracking::RecomputeIMUBiasAndCurrentNavstate(){//see VIORBSLAM paper IV-E
     //so vKFInit[i].mOdomPreIntIMU is based on bg_bar=bgest,ba_bar=0; dbg=0 but dba/ba waits to be optimized
     PreIntegration<IMUData>(1,mlOdomIMU,miterLastIMU,mv20pFramesReloc[i],mv20pFramesReloc[i+1]);//actually we don't need to copy the data list!
   }
+  unique_lock<mutex> lock(mMutexOdom);//CacheOdom() may drain the rings into the lists when they're full
   if (!mlOdomEnc.empty()){//we update miterLastEnc to current Frame for the next Frame's Preintegration(1/3)!
     listeig(EncData)::const_iterator iter=mlOdomEnc.end();
     iterijFind<EncData>(mlOdomEnc,mv20pFramesReloc[N-2]->mTimeStamp,iter,mdErrIMUImg);
@@ -530,7 +566,7 @@ Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer,
     mState(NO_IMAGES_YET), mSensor(sensor), mbOnlyTracking(false), mbVO(false), mpORBVocabulary(pVoc),
     mpKeyFrameDB(pKFDB), mpInitializer(static_cast<Initializer*>(NULL)), mpSystem(pSys), mpViewer(NULL),
     mpFrameDrawer(pFrameDrawer), mpMapDrawer(pMapDrawer), mpMap(pMap), mnLastRelocFrameId(0),
-    mbRelocBiasPrepare(false),mnLastOdomKFId(0),mbKeyFrameCreated(false)//zzh
+    mbRelocBiasPrepare(false),mbOdomWaiting(false),mnLastOdomKFId(0),mbKeyFrameCreated(false),mnPoseJumpIdxTrack(0),mdScaleTrack(1),mpRefKFTrack(NULL),mbVINSInitedTrack(false)//zzh
 {   
     // Load camera parameters from settings file
     cv::FileStorage fSettings(strSettingPath, cv::FileStorage::READ);
@@ -672,14 +708,70 @@ Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer,
     int nLevels = fSettings["ORBextractor.nLevels"];
     int fIniThFAST = fSettings["ORBextractor.iniThFAST"];
     int fMinThFAST = fSettings["ORBextractor.minThFAST"];
+    cv::FileNode fnORBThreads=fSettings["ORBextractor.nThreads"];//optional, number of threads extracting the pyramid levels of one image
+    int nORBThreads=fnORBThreads.empty()?1:(int)fnORBThreads;
+    if(nORBThreads<1) nORBThreads=1;
 
-    mpORBextractorLeft = new ORBextractor(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
+    mpORBextractorLeft = new ORBextractor(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST,nORBThreads);
 
     if(sensor==System::STEREO)
-        mpORBextractorRight = new ORBextractor(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
+        mpORBextractorRight = new ORBextractor(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST,nORBThreads);
 
     if(sensor==System::MONOCULAR)
-        mpIniORBextractor = new ORBextractor(2*nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
+        mpIniORBextractor = new ORBextractor(2*nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST,nORBThreads);
+
+    //long-lived extraction workers: the calling thread is one of the nORBThreads per image, and stereo extracts 2 images at once
+    int nPoolThreads = (sensor==System::STEREO?2*nORBThreads:nORBThreads)-1;
+    mpExtractorPool = nPoolThreads>0?new WorkerPool(nPoolThreads):static_cast<WorkerPool*>(NULL);
+    mpORBextractorLeft->SetWorkerPool(mpExtractorPool);
+    mpORBextractorLeft->SetRGB(mbRGB);
+    if(sensor==System::STEREO)
+    {
+        mpORBextractorRight->SetWorkerPool(mpExtractorPool);
+        mpORBextractorRight->SetRGB(mbRGB);
+    }
+    if(sensor==System::MONOCULAR)
+    {
+        mpIniORBextractor->SetWorkerPool(mpExtractorPool);
+        mpIniORBextractor->SetRGB(mbRGB);
+    }
+
+    //preallocate the pyramid buffers when the image size is known, or they're allocated by the first image
+    int nImgWidth = fSettings["Camera.width"], nImgHeight = fSettings["Camera.height"];
+    if(nImgWidth>0 && nImgHeight>0)
+    {
+        mpORBextractorLeft->AllocatePyramid(cv::Size(nImgWidth,nImgHeight));
+        if(sensor==System::STEREO)
+            mpORBextractorRight->AllocatePyramid(cv::Size(nImgWidth,nImgHeight));
+        if(sensor==System::MONOCULAR)
+            mpIniORBextractor->AllocatePyramid(cv::Size(nImgWidth,nImgHeight));
+        if(mDistCoef.at<float>(0)!=0.0)//so the first Frame doesn't pay for it
+            Frame::ComputeUndistortLUT(mK,mDistCoef,nImgWidth,nImgHeight);
+    }
+
+    //optional static masks(8bit image, 0 means no features there) of the parts always occluded, e.g. the vehicle body
+    cv::FileNode fnMask=fSettings["Camera.mask"];
+    if(!fnMask.empty()){
+      cv::Mat mask=cv::imread((string)fnMask,CV_LOAD_IMAGE_GRAYSCALE);
+      if(mask.empty()||(nImgWidth>0&&(mask.cols!=nImgWidth||mask.rows!=nImgHeight)))
+        cout<<redSTR"Camera.mask can't be loaded or doesn't match Camera.width/height, ignored!"<<whiteSTR<<endl;
+      else{
+        mpORBextractorLeft->SetStaticMask(mask);
+        if(sensor==System::MONOCULAR)
+          mpIniORBextractor->SetStaticMask(mask);
+        cout<<"- Static Mask: "<<(string)fnMask<<endl;
+      }
+    }
+    fnMask=fSettings["Camera.maskRight"];
+    if(sensor==System::STEREO&&!fnMask.empty()){
+      cv::Mat mask=cv::imread((string)fnMask,CV_LOAD_IMAGE_GRAYSCALE);
+      if(mask.empty()||(nImgWidth>0&&(mask.cols!=nImgWidth||mask.rows!=nImgHeight)))
+        cout<<redSTR"Camera.maskRight can't be loaded or doesn't match Camera.width/height, ignored!"<<whiteSTR<<endl;
+      else{
+        mpORBextractorRight->SetStaticMask(mask);
+        cout<<"- Static Mask Right: "<<(string)fnMask<<endl;
+      }
+    }
 
     cout << endl  << "ORB Extractor Parameters: " << endl;
     cout << "- Number of Features: " << nFeatures << endl;
@@ -687,6 +779,55 @@ Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer,
     cout << "- Scale Factor: " << fScaleFactor << endl;
     cout << "- Initial Fast Threshold: " << fIniThFAST << endl;
     cout << "- Minimum Fast Threshold: " << fMinThFAST << endl;
+    cout << "- Extraction Threads: " << nORBThreads << endl;
+
+    //optional latency budget of the front end
+    cv::FileNode fnBudget=fSettings["ORBextractor.budgetMs"];
+    mdBudgetMs=fnBudget.empty()?0:(double)fnBudget;
+    mdExtractCost=mdFrameCost=0;
+    if(mdBudgetMs>0){
+      cv::FileNode fn=fSettings["ORBextractor.minFeatures"];
+      mnMinFeatures=fn.empty()?nFeatures/2:(int)fn;
+      fn=fSettings["ORBextractor.maxFeatures"];
+      mnMaxFeatures=fn.empty()?nFeatures:(int)fn;
+      fn=fSettings["ORBextractor.minLevels"];
+      mnMinLevels=fn.empty()?nLevels:(int)fn;
+      fn=fSettings["ORBextractor.minInliers"];
+      mnMinInliersBudget=fn.empty()?50:(int)fn;
+      mnMaxLevels=nLevels;
+      if(mnMinLevels<1) mnMinLevels=1;
+      if(mnMinLevels>nLevels) mnMinLevels=nLevels;
+      if(mnMaxFeatures<mnMinFeatures) mnMaxFeatures=mnMinFeatures;
+      cout << "- Latency Budget: " << mdBudgetMs << "ms, Features: [" << mnMinFeatures << "," << mnMaxFeatures
+           << "], Levels: [" << mnMinLevels << "," << mnMaxLevels << "], Min Inliers: " << mnMinInliersBudget << endl;
+    }
+
+    //optional hybrid KLT+ORB front end, stereo needs the ORB of both images for the depth
+    cv::FileNode fnKLT=fSettings["Tracking.KLT"];
+    mbKLT=!fnKLT.empty()&&(int)fnKLT&&sensor!=System::STEREO;
+    mbNeedExtraction=mbKeyFrameNear=false;
+    mbLastFramePending=false;
+    if(mbKLT){
+      cv::FileNode fn=fSettings["Tracking.KLTMinTracked"];
+      mnKLTMinTracked=fn.empty()?80:(int)fn;
+      cout << "- KLT Front End: min tracked " << mnKLTMinTracked << endl;
+    }
+
+    //optional pipelined extraction/tracking, the extraction stage can't depend on the tracking of the former frame
+    cv::FileNode fnPipeline=fSettings["Tracking.PipelineDepth"];
+    mnPipelineDepth=fnPipeline.empty()?0:(int)fnPipeline;
+    fnPipeline=fSettings["Tracking.PipelineDrop"];
+    mnPipelineDrop=fnPipeline.empty()?PIPELINE_BLOCK:(int)fnPipeline;
+    mbPipelineBusy=mbPipelineFinish=false;
+    mbIniExtraction=true;
+    if(mnPipelineDepth>0){
+      if(mbKLT||mdBudgetMs>0){
+        cout<<redSTR"Tracking.KLT & ORBextractor.budgetMs need the tracking result of the former frame, disabled in the pipelined mode!"<<whiteSTR<<endl;
+        mbKLT=false;
+        mdBudgetMs=0;
+      }
+      cout << "- Pipelined Tracking: depth " << mnPipelineDepth << (mnPipelineDrop==PIPELINE_DROP_OLDEST?", drop oldest":", block") << endl;
+    }
 
     if(sensor==System::STEREO || sensor==System::RGBD)
     {
@@ -719,109 +860,294 @@ void Tracking::SetViewer(Viewer *pViewer)
 }
 
 
-cv::Mat Tracking::GrabImageStereo(const cv::Mat &imRectLeft, const cv::Mat &imRectRight, const double &timestamp)
+cv::Mat Tracking::GrabImageStereo(const cv::Mat &imRectLeft, const cv::Mat &imRectRight, const double &timestamp, const cv::Mat &mask)
 {
     mtmGrabDelay=chrono::steady_clock::now();//zzh
-    mImGray = imRectLeft;
-    cv::Mat imGrayRight = imRectRight;
+    ShiftLastFrame();
 
-    if(mImGray.channels()==3)
-    {
-        if(mbRGB)
-        {
-            cvtColor(mImGray,mImGray,CV_RGB2GRAY);
-            cvtColor(imGrayRight,imGrayRight,CV_RGB2GRAY);
-        }
-        else
-        {
-            cvtColor(mImGray,mImGray,CV_BGR2GRAY);
-            cvtColor(imGrayRight,imGrayRight,CV_BGR2GRAY);
-        }
+    //color images are converted to gray by the extractors straight into their level 0 buffers
+    chrono::steady_clock::time_point tm1=chrono::steady_clock::now();
+    mCurrentFrame = Frame(imRectLeft,imRectRight,timestamp,mpORBextractorLeft,mpORBextractorRight,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mask);
+    mdExtractCost=chrono::duration<double,milli>(chrono::steady_clock::now()-tm1).count();
+    mImGray = mpORBextractorLeft->mvImagePyramid[0];//valid until the next extraction, FrameDrawer copies it in Track()
+
+    Track();
+    AdaptFeatureBudget();
+
+    return mCurrentFrame.mTcw.clone();
+}
+
+cv::Mat Tracking::GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp, const cv::Mat &mask)
+{
+    mtmGrabDelay=chrono::steady_clock::now();//zzh
+    ShiftLastFrame();
+    cv::Mat imDepth = imD;
+
+    //CV_16U/CV_32F depth is kept raw, mDepthMapFactor is only applied at the keypoints in Frame::ComputeStereoFromRGBD()
+    if(imDepth.type()!=CV_16U && imDepth.type()!=CV_32F)
+        imDepth.convertTo(imDepth,CV_32F);
+
+    chrono::steady_clock::time_point tm1=chrono::steady_clock::now();
+    if(!GrabKLTFrame(imRGB,imDepth,timestamp,mask)){
+        mCurrentFrame = Frame(imRGB,imDepth,mDepthMapFactor,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mask);//here converting imRGB to gray & extracting the ORB features
+        mImGray = mpORBextractorLeft->mvImagePyramid[0];
+        UpdateKLTPyramid();
     }
-    else if(mImGray.channels()==4)
-    {
-        if(mbRGB)
-        {
-            cvtColor(mImGray,mImGray,CV_RGBA2GRAY);
-            cvtColor(imGrayRight,imGrayRight,CV_RGBA2GRAY);
-        }
+    mdExtractCost=chrono::duration<double,milli>(chrono::steady_clock::now()-tm1).count();
+    
+    cv::Mat img[2]={imRGB,imD};//only headers(refcounted), deep copied in XXXInitialization()/CreateNewKeyFrame() when a KF keeps them
+    Track(img);
+    AdaptFeatureBudget();
+
+    return mCurrentFrame.mTcw.clone();
+}
+
+
+cv::Mat Tracking::GrabImageMonocular(const cv::Mat &im, const double &timestamp, const cv::Mat &mask)
+{
+    mtmGrabDelay=chrono::steady_clock::now();//zzh
+    ShiftLastFrame();
+
+    chrono::steady_clock::time_point tm1=chrono::steady_clock::now();
+    if(!GrabKLTFrame(im,cv::Mat(),timestamp,mask)){
+        if(mState==NOT_INITIALIZED || mState==NO_IMAGES_YET)
+            mCurrentFrame = Frame(im,timestamp,mpIniORBextractor,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mask);
         else
-        {
-            cvtColor(mImGray,mImGray,CV_BGRA2GRAY);
-            cvtColor(imGrayRight,imGrayRight,CV_BGRA2GRAY);
-        }
+            mCurrentFrame = Frame(im,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mask);
+        mImGray = mCurrentFrame.mpORBextractorLeft->mvImagePyramid[0];
+        UpdateKLTPyramid();
     }
-
-    mCurrentFrame = Frame(mImGray,imGrayRight,timestamp,mpORBextractorLeft,mpORBextractorRight,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
+    mdExtractCost=chrono::duration<double,milli>(chrono::steady_clock::now()-tm1).count();
 
     Track();
+    AdaptFeatureBudget();
 
     return mCurrentFrame.mTcw.clone();
 }
 
-cv::Mat Tracking::GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp)
+future<cv::Mat> Tracking::GrabImageStereoAsync(const cv::Mat &imRectLeft, const cv::Mat &imRectRight, const double &timestamp, const cv::Mat &mask)
 {
-    mtmGrabDelay=chrono::steady_clock::now();//zzh
-    mImGray = imRGB;
+    PipelineFrame* pPF=new PipelineFrame;
+    pPF->tmGrab=chrono::steady_clock::now();
+
+    chrono::steady_clock::time_point tm1=chrono::steady_clock::now();
+    pPF->frame = Frame(imRectLeft,imRectRight,timestamp,mpORBextractorLeft,mpORBextractorRight,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mask);
+    pPF->dExtractCost=chrono::duration<double,milli>(chrono::steady_clock::now()-tm1).count();
+    pPF->imGray = mpORBextractorLeft->mvImagePyramid[0].clone();
+
+    return PushPipelineFrame(pPF);
+}
+
+future<cv::Mat> Tracking::GrabImageRGBDAsync(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp, const cv::Mat &mask)
+{
+    PipelineFrame* pPF=new PipelineFrame;
+    pPF->tmGrab=chrono::steady_clock::now();
     cv::Mat imDepth = imD;
 
-    //may be improved here!!!
-    if(mImGray.channels()==3)
+    if(imDepth.type()!=CV_16U && imDepth.type()!=CV_32F)
+        imDepth.convertTo(imDepth,CV_32F);
+
+    chrono::steady_clock::time_point tm1=chrono::steady_clock::now();
+    pPF->frame = Frame(imRGB,imDepth,mDepthMapFactor,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mask);
+    pPF->dExtractCost=chrono::duration<double,milli>(chrono::steady_clock::now()-tm1).count();
+    pPF->imGray = mpORBextractorLeft->mvImagePyramid[0].clone();
+    pPF->img[0]=imRGB;//only headers like GrabImageRGBD()
+    pPF->img[1]=imD;
+
+    return PushPipelineFrame(pPF);
+}
+
+future<cv::Mat> Tracking::GrabImageMonocularAsync(const cv::Mat &im, const double &timestamp, const cv::Mat &mask)
+{
+    PipelineFrame* pPF=new PipelineFrame;
+    pPF->tmGrab=chrono::steady_clock::now();
+
+    chrono::steady_clock::time_point tm1=chrono::steady_clock::now();
+    if(mbIniExtraction)//the queued Frames may still use it after the initialization, which only gives them more features
+        pPF->frame = Frame(im,timestamp,mpIniORBextractor,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mask);
+    else
+        pPF->frame = Frame(im,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mask);
+    pPF->dExtractCost=chrono::duration<double,milli>(chrono::steady_clock::now()-tm1).count();
+    pPF->imGray = pPF->frame.mpORBextractorLeft->mvImagePyramid[0].clone();
+
+    return PushPipelineFrame(pPF);
+}
+
+future<cv::Mat> Tracking::PushPipelineFrame(PipelineFrame* pPF)
+{
+    future<cv::Mat> fut=pPF->pose.get_future();
+    PipelineFrame* pDropped=NULL;
     {
-        if(mbRGB)
-            cvtColor(mImGray,mImGray,CV_RGB2GRAY);
-        else{
-            cvtColor(mImGray,mImGray,CV_BGR2GRAY);
-	}
+        unique_lock<mutex> lock(mMutexPipeline);
+        if(mnPipelineDrop==PIPELINE_DROP_OLDEST){
+            if(mdPipeline.size()>=(size_t)mnPipelineDepth){
+                pDropped=mdPipeline.front();
+                mdPipeline.pop_front();
+            }
+        }else
+            mCondPipeline.wait(lock,[this]{return mdPipeline.size()<(size_t)mnPipelineDepth;});
+        mdPipeline.push_back(pPF);
+    }
+    mCondPipeline.notify_all();
+    if(pDropped){//never tracked, so it's not in mlRelativeFramePoses either
+        pDropped->pose.set_value(cv::Mat());
+        delete pDropped;
     }
-    else if(mImGray.channels()==4)
+    return fut;
+}
+
+bool Tracking::TrackPipelineFrame(promise<cv::Mat> &pose,cv::Mat &Tcw)
+{
+    PipelineFrame* pPF;
     {
-        if(mbRGB)
-            cvtColor(mImGray,mImGray,CV_RGBA2GRAY);
-	else
-            cvtColor(mImGray,mImGray,CV_BGRA2GRAY);
+        unique_lock<mutex> lock(mMutexPipeline);
+        mCondPipeline.wait(lock,[this]{return mbPipelineFinish||!mdPipeline.empty();});
+        if(mdPipeline.empty())
+            return false;
+        pPF=mdPipeline.front();
+        mdPipeline.pop_front();
+        mbPipelineBusy=true;
     }
+    mCondPipeline.notify_all();//a blocked producer can push now
 
-    if((fabs(mDepthMapFactor-1.0f)>1e-5) || imDepth.type()!=CV_32F)
-        imDepth.convertTo(imDepth,CV_32F,mDepthMapFactor);
+    mtmGrabDelay=pPF->tmGrab;
+    ShiftLastFrame();
+    mCurrentFrame=std::move(pPF->frame);
+    mImGray=pPF->imGray;
+    mdExtractCost=pPF->dExtractCost;
 
-    mCurrentFrame = Frame(mImGray,imDepth,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);//here extracting the ORB features of ImGray
-    
-    cv::Mat img[2]={imRGB.clone(),imD.clone()};
-    Track(img);
+    if(mSensor==System::RGBD)
+        Track(pPF->img);
+    else
+        Track();
+    mbIniExtraction=mState==NOT_INITIALIZED || mState==NO_IMAGES_YET;
 
-    return mCurrentFrame.mTcw.clone();
+    Tcw=mCurrentFrame.mTcw.clone();
+    pose=std::move(pPF->pose);
+    delete pPF;
+    return true;
 }
 
+void Tracking::SetPipelineIdle()
+{
+    {
+        unique_lock<mutex> lock(mMutexPipeline);
+        mbPipelineBusy=false;
+    }
+    mCondPipeline.notify_all();
+}
 
-cv::Mat Tracking::GrabImageMonocular(const cv::Mat &im, const double &timestamp)
+void Tracking::WaitPipelineIdle()
 {
-    mtmGrabDelay=chrono::steady_clock::now();//zzh
-    mImGray = im;
+    unique_lock<mutex> lock(mMutexPipeline);
+    mCondPipeline.wait(lock,[this]{return mdPipeline.empty()&&!mbPipelineBusy;});
+}
 
-    if(mImGray.channels()==3)
+void Tracking::FinishPipeline()
+{
     {
-        if(mbRGB)
-            cvtColor(mImGray,mImGray,CV_RGB2GRAY);
-        else
-            cvtColor(mImGray,mImGray,CV_BGR2GRAY);
+        unique_lock<mutex> lock(mMutexPipeline);
+        mbPipelineFinish=true;
     }
-    else if(mImGray.channels()==4)
+    mCondPipeline.notify_all();
+}
+
+void Tracking::ShiftLastFrame()
+{
+    if(!mbLastFramePending)
+        return;
+    //the old mLastFrame's buffers are released here instead of deep copying the whole mCurrentFrame every frame
+    mLastFrame = std::move(mCurrentFrame);
+    mbLastFramePending=false;
+}
+
+bool Tracking::NeedFullExtraction()
+{
+    if(mState!=OK || mbOnlyTracking || mbNeedExtraction || mbKeyFrameNear)
+        return true;
+    if(mLastFrame.mnId+1!=Frame::nNextId || mLastFrame.N==0 || mvKLTPyramid.empty())//the pyramid must be the one of mLastFrame
+        return true;
+    if(mnMatchesInliers<mnKLTMinTracked)//tracking is getting weak
+        return true;
+    return mLastFrame.mnId+1>=mnLastKeyFrameId+mMaxFrames;//c1a of NeedNewKeyFrame() will be true
+}
+
+bool Tracking::GrabKLTFrame(const cv::Mat &im, const cv::Mat &imDepth, const double &timestamp, const cv::Mat &mask)
+{
+    if(!mbKLT || NeedFullExtraction())
+        return false;
+
+    cv::Mat imGray = im;
+    if(im.channels()==3)
+        cvtColor(im,imGray,mbRGB?CV_RGB2GRAY:CV_BGR2GRAY);
+    else if(im.channels()==4)
+        cvtColor(im,imGray,mbRGB?CV_RGBA2GRAY:CV_BGRA2GRAY);
+    vector<cv::Mat> vKLTPyramid;
+    cv::buildOpticalFlowPyramid(imGray,vKLTPyramid,cv::Size(KLT_WIN_SIZE,KLT_WIN_SIZE),KLT_MAX_LEVEL);
+
+    Frame frame(mvKLTPyramid,vKLTPyramid,imDepth,mDepthMapFactor,timestamp,mLastFrame,mask);
+    if(frame.N<mnKLTMinTracked)//too many points lost, this frame is extracted instead
+        return false;
+    mCurrentFrame = std::move(frame);
+    mvKLTPyramid.swap(vKLTPyramid);
+    mImGray = imGray;
+    return true;
+}
+
+int Tracking::KLTMatchesWithLastFrame()
+{
+    int nmatches=0;
+    for(int i=0; i<mCurrentFrame.N; i++)
     {
-        if(mbRGB)
-            cvtColor(mImGray,mImGray,CV_RGBA2GRAY);
+        MapPoint* pMP = mCurrentFrame.mvpMapPoints[i];
+        if(!pMP)
+            continue;
+        MapPoint* pRep = pMP->GetReplaced();
+        if(pRep)
+            pMP = mCurrentFrame.mvpMapPoints[i] = pRep;//like CheckReplacedInLastFrame()
+        if(pMP->isBad())
+            mCurrentFrame.mvpMapPoints[i]=static_cast<MapPoint*>(NULL);
         else
-            cvtColor(mImGray,mImGray,CV_BGRA2GRAY);
+            nmatches++;
     }
+    return nmatches;
+}
 
-    if(mState==NOT_INITIALIZED || mState==NO_IMAGES_YET)
-        mCurrentFrame = Frame(mImGray,timestamp,mpIniORBextractor,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
-    else
-        mCurrentFrame = Frame(mImGray,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
+void Tracking::UpdateKLTPyramid()
+{
+    mbNeedExtraction=false;
+    if(mbKLT)
+        cv::buildOpticalFlowPyramid(mImGray,mvKLTPyramid,cv::Size(KLT_WIN_SIZE,KLT_WIN_SIZE),KLT_MAX_LEVEL);
+}
 
-    Track();
+void Tracking::AdaptFeatureBudget()
+{
+    if(mdBudgetMs<=0)
+        return;
+    double tmCost=mdExtractCost+chrono::duration<double,milli>(chrono::steady_clock::now()-mtmTrackStart).count();
+    mdFrameCost=mdFrameCost<=0?tmCost:0.7*mdFrameCost+0.3*tmCost;//smoothed, a KF insertion shouldn't cut the features at once
+
+    int nFeatures=mpORBextractorLeft->GetFeaturesNum(),nLevels=mpORBextractorLeft->GetActiveLevels();
+    if(mState!=OK){//initialization, relocalization & odom-only tracking need all the features
+        nFeatures=mnMaxFeatures;
+        nLevels=mnMaxLevels;
+    }else if(mnMatchesInliers<mnMinInliersBudget){//the floor: tracking quality isn't traded for time
+        if(nLevels<mnMaxLevels) ++nLevels;
+        else nFeatures=nFeatures*1.2f;
+    }else if(mdFrameCost>mdBudgetMs){//over budget: fewer features first, then fewer levels
+        if(nFeatures>mnMinFeatures) nFeatures=nFeatures*max(0.8,mdBudgetMs/mdFrameCost);
+        else if(nLevels>mnMinLevels) --nLevels;
+    }else if(mdFrameCost<0.8*mdBudgetMs){//enough slack: levels back first, then features
+        if(nLevels<mnMaxLevels) ++nLevels;
+        else nFeatures=nFeatures*1.05f+1;
+    }
+    nFeatures=max(mnMinFeatures,min(mnMaxFeatures,nFeatures));
 
-    return mCurrentFrame.mTcw.clone();
+    if(nFeatures!=mpORBextractorLeft->GetFeaturesNum()||nLevels!=mpORBextractorLeft->GetActiveLevels()){
+        mpORBextractorLeft->SetFeaturesNum(nFeatures,nLevels);
+        if(mSensor==System::STEREO)
+            mpORBextractorRight->SetFeaturesNum(nFeatures,nLevels);
+    }
 }
 
 void Tracking::Track(cv::Mat img[2])//changed a lot by zzh inspired by JingWang
@@ -833,24 +1159,39 @@ void Tracking::Track(cv::Mat img[2])//changed a lot by zzh inspired by JingWang
 
     mLastProcessedState=mState;
 
-    // Get Map Mutex -> Map cannot be changed
-    unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
-    
-    //delay control
+    //delay control, before locking the map so LocalMapping/LoopClosing aren't blocked by the waiting
     {
     char sensorType=0;//0 for nothing, 1 for encoder, 2 for IMU, 3 for encoder+IMU
     if (mpIMUInitiator->GetSensorEnc()) ++sensorType;
     if (mpIMUInitiator->GetSensorIMU()) sensorType+=2;
-    unique_lock<mutex> lock2(mMutexOdom);
-    if (sensorType==1&&(mlOdomEnc.empty()||mlOdomEnc.back().mtm<mCurrentFrame.mTimeStamp)||
-	sensorType==2&&(mlOdomIMU.empty()||mlOdomIMU.back().mtm<mCurrentFrame.mTimeStamp)||
-	sensorType==3&&(mlOdomEnc.empty()||mlOdomEnc.back().mtm<mCurrentFrame.mTimeStamp||mlOdomIMU.empty()||mlOdomIMU.back().mtm<mCurrentFrame.mTimeStamp)){
-      lock2.unlock();//then delay some ms to ensure some Odom data to come if it runs well
+    const double &tmCur=mCurrentFrame.mTimeStamp;
+    auto bOdomReady=[&]{//the newest Odom data of the used sensors reaches this frame
+      return (!(sensorType&1)||mRingEnc.NewestTime()>=tmCur)&&(!(sensorType&2)||mRingIMU.NewestTime()>=tmCur);
+    };
+    if (!bOdomReady()){//then delay some ms to ensure some Odom data to come if it runs well, CacheOdom() wakes it once the data comes
       mtmGrabDelay+=chrono::duration_cast<chrono::nanoseconds>(chrono::duration<double>(mDelayCache));//delay default=20ms
-      while (chrono::steady_clock::now()<mtmGrabDelay) usleep(1000);//allow 1ms delay error
+      unique_lock<mutex> lock2(mMutexOdomWait);
+      mbOdomWaiting=true;
+      mCondOdom.wait_until(lock2,mtmGrabDelay,bOdomReady);
+      mbOdomWaiting=false;
     }//if still no Odom data comes, deltax~ij will be set unknown
     }
-    
+    {
+    unique_lock<mutex> lock2(mMutexOdom);
+    DrainOdom();
+    TrimOdom();//so the Odom lists don't grow without new KFs, e.g. when LOST
+    }
+
+    // Map isn't locked during the tracking(LoopClosing/GBA can update it meanwhile), only the map version it starts from is recorded
+    mtmTrackStart=chrono::steady_clock::now();//the waiting above doesn't count in the latency budget
+    ++MapPoint::nTrackSnapshotId;//the last frame's snapshot is outdated, the tracking before SnapshotLocalMap() reads the current map as an initial guess
+    mbVINSInitedTrack=mpIMUInitiator->GetVINSInited();
+    if(mState!=NOT_INITIALIZED)//mpReferenceKF may be erased by Reset() before
+    {
+        unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+        RecordMapVersion();
+    }
+
     // Different operation, according to whether the map is updated
     bool bMapUpdated=false;
     static int premapid=0;
@@ -859,10 +1200,14 @@ void Tracking::Track(cv::Mat img[2])//changed a lot by zzh inspired by JingWang
 
     if(mState==NOT_INITIALIZED)
     {
+        {
+        unique_lock<mutex> lock(mpMap->mMutexMapUpdate);//the initial map is created here
         if(mSensor==System::STEREO || mSensor==System::RGBD)
             StereoInitialization(img);
         else
             MonocularInitialization();
+        RecordMapVersion();
+        }
 
         mpFrameDrawer->Update(this);
 
@@ -885,7 +1230,7 @@ void Tracking::Track(cv::Mat img[2])//changed a lot by zzh inspired by JingWang
                 // Local Mapping might have changed some MapPoints tracked in last frame
                 CheckReplacedInLastFrame();//so use the replaced ones
 
-		if (mpIMUInitiator->GetVINSInited()){//if IMU info(bgi,gw,bai) is intialized use IMU motion model
+		if (mbVINSInitedTrack){//if IMU info(bgi,gw,bai) is intialized use IMU motion model
 		    if (!mbRelocBiasPrepare){//but still need >=20 Frames after reloc, bi becomes ok for IMU motion update(calculated in 19th Frame after reloc. KF)
 		      bOK=TrackWithIMU(bMapUpdated);
 		      if(!bOK){
@@ -942,7 +1287,7 @@ void Tracking::Track(cv::Mat img[2])//changed a lot by zzh inspired by JingWang
                 bOK = Relocalization();
 		cout<<"Lost--Local. Mode"<<endl;
             }
-            else if (mpIMUInitiator->GetVINSInited()){//if IMU info(bgi,gw,bai) is intialized use IMU motion model
+            else if (mbVINSInitedTrack){//if IMU info(bgi,gw,bai) is intialized use IMU motion model
 	      // Todo: Add VIO & VIEO Tracking Mode, it's not key for our target, so we haven't finished this part
 	      cout<<redSTR<<"Entering Wrong Tracking Mode With VIO/VIEO, Please Check!"<<endl;
 	      assert(0);
@@ -1017,7 +1362,7 @@ void Tracking::Track(cv::Mat img[2])//changed a lot by zzh inspired by JingWang
         if(!mbOnlyTracking)
         {
             if(bOK){
-	      if(!mpIMUInitiator->GetVINSInited()||mbRelocBiasPrepare)//if imu not intialized(including relocalized bias recomputation)
+	      if(!mbVINSInitedTrack||mbRelocBiasPrepare)//if imu not intialized(including relocalized bias recomputation)
                 bOK = TrackLocalMap();
 	      else
 		bOK = TrackLocalMapWithIMU(bMapUpdated);
@@ -1171,10 +1516,12 @@ void Tracking::Track(cv::Mat img[2])//changed a lot by zzh inspired by JingWang
         if(!mCurrentFrame.mpReferenceKF)//when mCurrentFrame is not KF but it cannot see common MPs in local MPs(e.g. it has all new MPs but it's not inserted as new KF & you can get its mTcw through other odometry)
             mCurrentFrame.mpReferenceKF = mpReferenceKF;
 
-        mLastFrame = Frame(mCurrentFrame);//copy constructor for some Mat.clone() and vec<>[][] deep copy, notice mLastFrame is also set in XXXInitialization()!
+        mbLastFramePending=true;//mCurrentFrame is moved to mLastFrame in ShiftLastFrame() when the next image comes, for System still reads it, notice mLastFrame is also set in XXXInitialization()!
     }
 
     // Store frame pose information to retrieve the complete camera trajectory afterwards.
+    unique_lock<mutex> lockMapUpdate(mpMap->mMutexMapUpdate);//the reference KF's pose cannot be corrected between the reanchor and Tcr
+    ReanchorCurrentFrame();//so Tcr below is right for UpdateLastFrame() of the next frame
     if(!mCurrentFrame.mTcw.empty())
     {
         cv::Mat Tcr = mCurrentFrame.mTcw*mCurrentFrame.mpReferenceKF->GetPoseInverse();//when it's lost but get an initial pose through motion-only BA , it can still recover one low-quality estimation, used in UpdateLastFrame()
@@ -1206,7 +1553,7 @@ void Tracking::StereoInitialization(cv::Mat img[2])
 
         // Create KeyFrame
         KeyFrame* pKFini = new KeyFrame(mCurrentFrame,mpMap,mpKeyFrameDB);
-	if (img){ pKFini->Img[0]=img[0];pKFini->Img[1]=img[1];}
+	if (img){ pKFini->Img[0]=img[0].clone();pKFini->Img[1]=img[1].clone();}
 
         // Insert KeyFrame in the map
         mpMap->AddKeyFrame(pKFini);
@@ -1433,6 +1780,59 @@ void Tracking::CreateInitialMapMonocular()
     mState=OK;
 }
 
+void Tracking::RecordMapVersion()
+{
+    mnPoseJumpIdxTrack=mpMap->GetLastPoseJumpIdx();
+    mdScaleTrack=mpMap->GetScaleChange();
+    mpRefKFTrack=mpReferenceKF;
+    if (mpRefKFTrack) mTwrTrack=mpRefKFTrack->GetPoseInverse();
+}
+
+void Tracking::ReanchorCurrentFrame()
+{
+    //InformPoseJump()/InformNewScale() is called under mMutexMapUpdate right after the KFs' Pose are corrected
+    double dScale=mpMap->GetScaleChange();
+    if(mpMap->GetLastPoseJumpIdx()==mnPoseJumpIdxTrack&&dScale==mdScaleTrack)
+        return;
+    if(mpRefKFTrack&&!mCurrentFrame.mTcw.empty())//else not initialized when the tracking starts or no pose got
+    {
+        // Keep the pose relative to the reference KF as UpdateLastFrame() does, mVelocity is already got in the old map
+        cv::Mat Tcr=mCurrentFrame.mTcw*mTwrTrack;
+        cv::Mat tcr=Tcr.rowRange(0,3).col(3)*(dScale/mdScaleTrack);//the scale update also scales the distance to the reference KF
+        tcr.copyTo(Tcr.rowRange(0,3).col(3));
+        mCurrentFrame.SetPose(Tcr*mpRefKFTrack->GetPose());//Tcr*Trw(corrected)
+        if(mbVINSInitedTrack)
+            mCurrentFrame.UpdateNavStatePVRFromTcw();//velocity is also rotated
+        cout<<redSTR"Map corrected during tracking, reanchored Frame "<<mCurrentFrame.mnId<<whiteSTR<<endl;
+    }
+    RecordMapVersion();
+}
+
+void Tracking::SnapshotLocalMap()
+{
+    unique_lock<mutex> lock(mpMap->mMutexMapUpdate);//no LBA/loop correction/GBA/scale update can be written back during the copy
+    ReanchorCurrentFrame();//mCurrentFrame's pose belongs to the snapshot below
+    RecordMapVersion();//mpReferenceKF may be changed by UpdateLocalKeyFrames()
+
+    ++MapPoint::nTrackSnapshotId;
+    for(vector<MapPoint*>::const_iterator itMP=mvpLocalMapPoints.begin(), itEndMP=mvpLocalMapPoints.end(); itMP!=itEndMP; itMP++)
+        (*itMP)->SnapshotForTrack();
+    for(int i=0; i<mCurrentFrame.N; i++)//the matched MPs are mostly in mvpLocalMapPoints
+    {
+        MapPoint* pMP = mCurrentFrame.mvpMapPoints[i];
+        if(pMP && pMP->mnTrackSnapshotId!=MapPoint::nTrackSnapshotId)
+            pMP->SnapshotForTrack();
+    }
+    for(int i=0; i<mLastFrame.N; i++)//for the edges of the unfixed last Frame in the IMU motion-only BA
+    {
+        MapPoint* pMP = mLastFrame.mvpMapPoints[i];
+        if(pMP && pMP->mnTrackSnapshotId!=MapPoint::nTrackSnapshotId)
+            pMP->SnapshotForTrack();
+    }
+    if(mpLastKeyFrame)
+        mpLastKeyFrame->SnapshotForTrack();//for the IMU motion-only BA
+}
+
 void Tracking::CheckReplacedInLastFrame()
 {
     for(int i =0; i<mLastFrame.N; i++)
@@ -1573,21 +1973,26 @@ bool Tracking::TrackWithMotionModel()
 
     mCurrentFrame.SetPose(mVelocity*mLastFrame.mTcw);//Tc2c1*Tc1w
 
-    fill(mCurrentFrame.mvpMapPoints.begin(),mCurrentFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
-
     // Project points seen in previous frame
     int th;
     if(mSensor!=System::STEREO)
         th=15;
     else
         th=7;
-    int nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,th,mSensor==System::MONOCULAR);//has CurrentFrame.mvpMapPoints[bestIdx2]=pMP; in this func. then it can use m-o BA
-
-    // If few matches, uses a wider window search
+    int nmatches = 0;
+    if(mCurrentFrame.mbKLT)//the optical flow already gives the correspondences with mLastFrame
+        nmatches = KLTMatchesWithLastFrame();
     if(nmatches<20)
     {
-        fill(mCurrentFrame.mvpMapPoints.begin(),mCurrentFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));//it's important for SBP() will not rectify the alreay nice CurretFrame.mvpMapPoints
-        nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,2*th,mSensor==System::MONOCULAR);
+        fill(mCurrentFrame.mvpMapPoints.begin(),mCurrentFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
+        nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,th,mSensor==System::MONOCULAR);//has CurrentFrame.mvpMapPoints[bestIdx2]=pMP; in this func. then it can use m-o BA
+
+        // If few matches, uses a wider window search
+        if(nmatches<20)
+        {
+            fill(mCurrentFrame.mvpMapPoints.begin(),mCurrentFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));//it's important for SBP() will not rectify the alreay nice CurretFrame.mvpMapPoints
+            nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,2*th,mSensor==System::MONOCULAR);
+        }
     }
 
     if(nmatches<20)
@@ -1682,6 +2087,7 @@ bool Tracking::TrackLocalMap()
 
 bool Tracking::NeedNewKeyFrame()
 {   
+    mbKeyFrameNear=false;
     if(mbOnlyTracking)
         return false;
 
@@ -1758,8 +2164,16 @@ bool Tracking::NeedNewKeyFrame()
     //Condition 3: odom && time conditon && min new close points' demand
     const bool c3=(mState==ODOMOK)&&(c1a||c1b||c1c)&&nNonTrackedClose>70;//may we can also use &&mCurrentFrame.N>500 like StereoInitialization()
 
+    //for the KLT front end: the inliers are close to the c2 threshold, so the next frame is extracted to be a KF candidate
+    mbKeyFrameNear = mnMatchesInliers<nRefMatches*thRefRatio*1.1f || c1c;
+
     if((c1a||c1b||c1c)&&c2||cTimeGap||c3)//cTimeGap added by JingWang
     {
+        if(mCurrentFrame.mbKLT)//a KF needs its own ORB features, so it's delayed to the next(extracted) frame
+        {
+            mbNeedExtraction=true;
+            return false;
+        }
         // If the mapping accepts keyframes, insert keyframe.
         // Otherwise send a signal to interrupt BA
         if(bLocalMappingIdle)
@@ -1788,6 +2202,9 @@ void Tracking::CreateNewKeyFrame(cv::Mat img[2])
 {
     if(!mpLocalMapper->SetNotStop(true))//if localMapper is stopped by loop closing thread/GUI, cannot add KFs; during adding process, it cannot be stopped by others
         return;
+    //LoopClosing/GBA/IMUInitialization cannot stop LocalMapping now, so a big change of the map can only be already done before the lock
+    unique_lock<mutex> lock(mpMap->mMutexMapUpdate);//commit the new KF&&MPs
+    ReanchorCurrentFrame();
 
     //ensure Tcw is always right for mCurrentFrame even there's no odom data, NavState/Tbw can be wrong when there's no odom data
     KeyFrame* pKF = new KeyFrame(mCurrentFrame,mpMap,mpKeyFrameDB,mpLastKeyFrame,mState);//copy initial Tcw&Tbw(even wrong), update bi=bi+dbi
@@ -1802,7 +2219,7 @@ void Tracking::CreateNewKeyFrame(cv::Mat img[2])
 
     if(mSensor!=System::MONOCULAR)
     {	
-	if (img){ pKF->Img[0]=img[0];pKF->Img[1]=img[1];}//zzh for PCL map creation
+	if (img){ pKF->Img[0]=img[0].clone();pKF->Img[1]=img[1].clone();}//zzh for PCL map creation, the caller may reuse its buffers
 	
 	
         mCurrentFrame.UpdatePoseMatrices();//UnprojectStereo() use mRwc,mOw, maybe useless
@@ -1898,9 +2315,9 @@ void Tracking::SearchLocalPoints()
         }
     }
 
-    int nToMatch=0;
-
     // Project points in frame and check its visibility
+    vector<MapPoint*> vpCandidates;
+    vpCandidates.reserve(mvpLocalMapPoints.size());
     for(vector<MapPoint*>::iterator vit=mvpLocalMapPoints.begin(), vend=mvpLocalMapPoints.end(); vit!=vend; vit++)
     {
         MapPoint* pMP = *vit;
@@ -1908,14 +2325,14 @@ void Tracking::SearchLocalPoints()
             continue;
         if(pMP->isBad())
             continue;
-        // Project (this fills MapPoint variables for matching,like mbTrackInView=true...)
-	//judge if mCurrentFrame's centre is in the effective descriptor area(scale&&rotation invariance) of the MapPoint(with best descriptor&&normalVector)
-        if(mCurrentFrame.isInFrustum(pMP,0.5))//no problem for mRcw,mtcw for mCurrentFrame.SetPose() in TrackWithMotionModel()/TrackReferenceKeyFrame()
-        {
-            pMP->IncreaseVisible();
-            nToMatch++;
-        }
+        vpCandidates.push_back(pMP);
     }
+    // Project (this fills MapPoint variables for matching,like mbTrackInView=true...) in one batch
+    //judge if mCurrentFrame's centre is in the effective descriptor area(scale&&rotation invariance) of the MapPoint(with best descriptor&&normalVector)
+    vector<MapPoint*> vpInView;
+    const int nToMatch=mCurrentFrame.isInFrustum(vpCandidates,0.5,vpInView);//no problem for mRcw,mtcw for mCurrentFrame.SetPose() in TrackWithMotionModel()/TrackReferenceKeyFrame()
+    for(size_t i=0; i<vpInView.size(); i++)
+        vpInView[i]->IncreaseVisible();
 
     if(nToMatch>0)
     {
@@ -1926,7 +2343,9 @@ void Tracking::SearchLocalPoints()
         // If the camera has been relocalised recently, perform a coarser search
         if(mCurrentFrame.mnId<mnLastRelocFrameId+2)
             th=5;
-        matcher.SearchByProjection(mCurrentFrame,mvpLocalMapPoints,th);//rectify the mCurrentFrame.mvpMapPoints
+        //when pipelined the grabbing thread extracts the next Frame on mpExtractorPool meanwhile, Wait() here could run its tasks, so it's serial
+        WorkerPool* pPool=mnPipelineDepth>0?NULL:mpExtractorPool;
+        matcher.SearchByProjection(mCurrentFrame,vpInView,th,pPool);//rectify the mCurrentFrame.mvpMapPoints, parallel in large local maps, vpInView keeps the order of mvpLocalMapPoints
     }
 }
 
@@ -1938,6 +2357,7 @@ void Tracking::UpdateLocalMap()
     // Update
     UpdateLocalKeyFrames();
     UpdateLocalPoints();
+    SnapshotLocalMap();
 }
 
 void Tracking::UpdateLocalPoints()
@@ -2282,6 +2702,9 @@ void Tracking::Reset()
     KeyFrame::nNextId = 0;
     Frame::nNextId = 0;
     mState = NO_IMAGES_YET;
+    mbLastFramePending=false;//mCurrentFrame may refer to the erased MapPoints
+    mpRefKFTrack=NULL;
+    mbIniExtraction=true;
     
     //for monocular!
     if(mpInitializer)
@@ -2330,6 +2753,11 @@ void Tracking::ChangeCalibration(const string &strSettingPath)
     mbf = fSettings["Camera.bf"];
 
     Frame::mbInitialComputations = true;
+    Frame::mbUndistortLUTValid = false;//the undistortion lookup table is rebuilt for the new mK & mDistCoef
+    Frame::mUndistortLUT.release();
+    int nImgWidth = fSettings["Camera.width"], nImgHeight = fSettings["Camera.height"];
+    if(nImgWidth>0 && nImgHeight>0 && mDistCoef.at<float>(0)!=0.0)//else the next Frame builds it
+        Frame::ComputeUndistortLUT(mK,mDistCoef,nImgWidth,nImgHeight);
 }
 
 void Tracking::InformOnlyTracking(const bool &flag)
@@ -0,0 +1,82 @@
+//created by zzh
+#include "WorkerPool.h"
+#include <memory>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+WorkerPool::WorkerPool(int nThreads):mbFinish(false)
+{
+    mvThreads.reserve(nThreads);
+    for(int i=0; i<nThreads; ++i)
+        mvThreads.push_back(thread(&WorkerPool::Run,this));
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        unique_lock<mutex> lock(mMutexTasks);
+        mbFinish=true;
+    }
+    mCondTasks.notify_all();
+    for(size_t i=0; i<mvThreads.size(); ++i)
+        mvThreads[i].join();
+}
+
+future<void> WorkerPool::Submit(const function<void()> &task)
+{
+    //std::function needs a copyable target, so the move-only packaged_task is shared
+    shared_ptr<packaged_task<void()> > pTask=make_shared<packaged_task<void()> >(task);
+    future<void> fut=pTask->get_future();
+    {
+        unique_lock<mutex> lock(mMutexTasks);
+        mdTasks.push_back([pTask](){(*pTask)();});
+    }
+    mCondTasks.notify_one();
+    return fut;
+}
+
+void WorkerPool::Wait(future<void> &fut)
+{
+    function<void()> task;
+    while(fut.wait_for(chrono::seconds(0))!=future_status::ready){
+        if(PopTask(task))
+            task();
+        else{//fut's task is already running on another thread, which helps its own subtasks in the same way
+            fut.wait();
+            break;
+        }
+    }
+    fut.get();//rethrow the exception of the task if any
+}
+
+bool WorkerPool::PopTask(function<void()> &task)
+{
+    unique_lock<mutex> lock(mMutexTasks);
+    if(mdTasks.empty())
+        return false;
+    task=mdTasks.front();
+    mdTasks.pop_front();
+    return true;
+}
+
+void WorkerPool::Run()
+{
+    function<void()> task;
+    while(1){
+        {
+            unique_lock<mutex> lock(mMutexTasks);
+            mCondTasks.wait(lock,[this]{return mbFinish||!mdTasks.empty();});
+            if(mdTasks.empty())//mbFinish && no task left
+                break;
+            task=mdTasks.front();
+            mdTasks.pop_front();
+        }
+        task();
+        task=nullptr;//release the finished task's state before sleeping
+    }
+}
+
+} //namespace ORB_SLAM